@@ -35,11 +35,34 @@ int main(int argc, char **argv)
     nob_cmd_append(&cmd, "-o", BUILD_DIR"/blnc.exe");
     nob_cmd_append(&cmd, "./src/bulan.c");
     nob_cmd_append(&cmd, "./src/lexer.c");
+    nob_cmd_append(&cmd, "./src/scan.c");
+    nob_cmd_append(&cmd, "./src/number.c");
+    nob_cmd_append(&cmd, "./src/intern.c");
+    nob_cmd_append(&cmd, "./src/source_file.c");
+    nob_cmd_append(&cmd, "./src/thread.c");
+    nob_cmd_append(&cmd, "./src/queue.c");
+    nob_cmd_append(&cmd, "./src/cache.c");
+    nob_cmd_append(&cmd, "./src/server.c");
+    nob_cmd_append(&cmd, "./src/ast.c");
     nob_cmd_append(&cmd, "./src/codegen.c");
     nob_cmd_append(&cmd, "./src/codegen_fasm_x86_64_win32.c");
     nob_cmd_append(&cmd, "./build/nob.o");
     nob_cmd_append(&cmd, "./build/arena.o");
     nob_cmd_append(&cmd, "./build/flag.o");
+#ifndef _WIN32
+    nob_cmd_append(&cmd, "-lpthread");
+#endif
+    if(!nob_cmd_run_sync_and_reset(&cmd)) return -1;
+
+    nob_cc(&cmd);
+    nob_cmd_append(&cmd, "-Wall", "-Wextra", "-g", "-fsanitize=address");
+    nob_cmd_append(&cmd, "-D_CRT_SECURE_NO_WARNINGS");
+    nob_cmd_append(&cmd, "-I", "thirdparty");
+    nob_cmd_append(&cmd, "-I", "src");
+    nob_cmd_append(&cmd, "-o", BUILD_DIR"/blnc-client.exe");
+    nob_cmd_append(&cmd, "./src/blnc_client.c");
+    nob_cmd_append(&cmd, "./src/server.c");
+    nob_cmd_append(&cmd, "./build/nob.o");
     nob_cmd_run_sync_and_reset(&cmd);
 
     return 0;
@@ -0,0 +1,31 @@
+#include "ast.h"
+#include <assert.h>
+
+NodeId ast_push_node(Ast *ast, Node node)
+{
+    // Slot 0 stays unused so that 0 can mean no node
+    if(ast->nodes.count == 0) arena_da_append(&ast->arena, &ast->nodes, (Node) {0});
+    assert(ast->nodes.count < UINT32_MAX && "Buy more RAM LOL!");
+    NodeId id = (NodeId)ast->nodes.count;
+    arena_da_append(&ast->arena, &ast->nodes, node);
+    return id;
+}
+
+NodeList ast_push_list(Ast *ast, const NodeId *ids, size_t count)
+{
+    assert(ast->children.count + count < UINT32_MAX && "Buy more RAM LOL!");
+    NodeList list = { .first = (uint32_t)ast->children.count, .count = (uint32_t)count };
+    if(count > 0) arena_da_append_many(&ast->arena, &ast->children, ids, count);
+    return list;
+}
+
+void ast_free(Ast *ast)
+{
+    arena_free(&ast->arena);
+    ast->nodes.items = NULL;
+    ast->nodes.count = 0;
+    ast->nodes.capacity = 0;
+    ast->children.items = NULL;
+    ast->children.count = 0;
+    ast->children.capacity = 0;
+}
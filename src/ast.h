@@ -0,0 +1,105 @@
+#ifndef AST_H_
+#define AST_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include "arena.h"
+#include "lexer.h"
+
+// What the parser hands to IR lowering. Nodes refer to each other by
+// index and lists of children live in a side array, all of it allocated
+// from the arena of the function's Ast and dropped with it.
+
+typedef uint32_t NodeId; // index into Ast.nodes, 0 is no node
+
+typedef enum {
+    NODE_NONE = 0,
+
+    // Expressions
+    NODE_INT,       // int_value
+    NODE_STRING,    // static_offset
+    NODE_VAR,       // var
+    NODE_DEREF,     // *a
+    NODE_CALL,      // name(list)
+    NODE_BINOP,     // a op b
+    NODE_ASSIGN,    // a = b, or a op= b
+    NODE_COND,      // a ? b : c
+
+    // Statements, any expression is one too
+    NODE_BLOCK,     // { list }
+    NODE_IF,        // if(a) b else c, c is 0, a block or the next if
+    NODE_WHILE,     // while(a) b
+    NODE_EXTERN,    // extern name;
+} NodeKind;
+
+typedef struct {
+    uint32_t first; // index into Ast.children
+    uint32_t count;
+} NodeList;
+
+typedef struct {
+    uint8_t kind; // NodeKind
+    uint8_t op;   // InstKind of a NODE_BINOP, or of a NODE_ASSIGN with INST_NOP for =
+    // Stands for an expression folded down to it, like a in 0 + a, which
+    // can not be assigned to even when a could
+    uint8_t folded;
+    Loc loc;
+    NodeId a, b, c;
+    union {
+        int64_t int_value;
+        size_t static_offset;
+        uint32_t var;  // index into the variables of the function
+        uint32_t name; // interned
+    };
+    NodeList list;
+} Node;
+
+typedef struct {
+    Arena arena;
+
+    struct {
+        Node *items;
+        size_t count;
+        size_t capacity;
+    } nodes;
+
+    struct {
+        NodeId *items;
+        size_t count;
+        size_t capacity;
+    } children;
+} Ast;
+
+typedef struct {
+    Loc loc;
+    uint32_t name; // interned
+    // Variables are numbered in the order they are declared, parameters
+    // first
+    size_t count_params;
+    size_t count_vars;
+    // Its string literals in the static data
+    size_t static_begin;
+    size_t static_end;
+    NodeId body;
+    Ast ast;
+} AstFunction;
+
+NodeId ast_push_node(Ast *ast, Node node);
+// Copies the ids into the side array, lists are built elsewhere and
+// stored once they are complete since they nest
+NodeList ast_push_list(Ast *ast, const NodeId *ids, size_t count);
+void ast_free(Ast *ast);
+
+static inline Node *ast_node(const Ast *ast, NodeId id)
+{
+    assert(0 < id && id < ast->nodes.count);
+    return &ast->nodes.items[id];
+}
+
+static inline NodeId ast_child(const Ast *ast, NodeList list, size_t index)
+{
+    assert(index < list.count);
+    return ast->children.items[list.first + index];
+}
+
+#endif // AST_H_
@@ -0,0 +1,12 @@
+#include <stdio.h>
+#include "server.h"
+
+// Thin client of `blnc -server`, runs one blnc command on the server
+int main(int argc, char **argv)
+{
+    if(argc < 2) {
+        fprintf(stderr, "Usage: %s <SOCKET> [blnc OPTIONS...] [--] <INPUT>\n", argv[0]);
+        return -1;
+    }
+    return server_send_command(argv[1], argc - 2, argv + 2);
+}
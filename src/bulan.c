@@ -1,9 +1,17 @@
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include "nob.h"
 #include "arena.h"
 #include "lexer.h"
+#include "intern.h"
+#include "source_file.h"
+#include "thread.h"
+#include "queue.h"
+#include "cache.h"
+#include "server.h"
 #include "codegen.h"
+#include "ast.h"
 #include "flag.h"
 
 typedef enum {
@@ -12,11 +20,20 @@ typedef enum {
 } VarStorage;
 
 typedef struct {
-    const char *name;
-    size_t index;
+    uint32_t name; // interned
+    size_t index;  // numbered within its function, see AstFunction
     VarStorage storage;
+    // The binding of the same name this one shadows, index into
+    // Compiler.vars plus one, 0 when there is none
+    size_t shadowed;
 } Var;
 
+// Open addressing table from a name to its innermost binding
+typedef struct {
+    uint32_t name; // 0 is an empty slot
+    uint32_t var;  // index into Compiler.vars
+} VarSlot;
+
 typedef struct Compiler {
     Arena arena;
     Target target;
@@ -28,122 +45,333 @@ typedef struct Compiler {
         size_t capacity;
     } funcs;
 
+    // Every binding in scope, innermost last
     struct {
         Var *items;
         size_t count;
         size_t capacity;
     } vars;
+
+    struct {
+        VarSlot *items;
+        size_t count;
+        size_t capacity; // a power of two, at most half full
+    } var_slots;
+
+    // vars.count at every scope_push()
+    struct {
+        size_t *items;
+        size_t count;
+        size_t capacity;
+    } scopes;
+
+    // Children of the lists being parsed, stored in the Ast once complete
+    struct {
+        NodeId *items;
+        size_t count;
+        size_t capacity;
+    } pending_nodes;
+
+    // Temporaries of the function being lowered that hold no live value,
+    // locals from first_temp on are temporaries, the ones before are variables
+    size_t first_temp;
+    struct {
+        size_t *items;
+        size_t count;
+        size_t capacity;
+    } free_temps;
 } Compiler;
 
-Var *find_var(const Compiler *com, const char *name)
+static size_t var_slot_home(const Compiler *com, uint32_t name)
+{
+    // Names are small sequential ids, Fibonacci hashing spreads them out
+    return (size_t)(name * 0x9E3779B1u) & (com->var_slots.capacity - 1);
+}
+
+static VarSlot *var_slot_find(const Compiler *com, uint32_t name)
 {
-    for(size_t i = 0; i < com->vars.count; ++i) {
-        if(strcmp(com->vars.items[i].name, name) == 0) {
-            return &com->vars.items[i];
+    if(com->var_slots.capacity == 0) return NULL;
+    size_t mask = com->var_slots.capacity - 1;
+    for(size_t i = var_slot_home(com, name);; i = (i + 1) & mask) {
+        VarSlot *slot = &com->var_slots.items[i];
+        if(slot->name == name) return slot;
+        if(slot->name == 0) return NULL;
+    }
+}
+
+static void var_slot_insert(Compiler *com, uint32_t name, uint32_t var)
+{
+    size_t mask = com->var_slots.capacity - 1;
+    size_t i = var_slot_home(com, name);
+    while(com->var_slots.items[i].name != 0) i = (i + 1) & mask;
+    com->var_slots.items[i] = (VarSlot) { .name = name, .var = var };
+    com->var_slots.count += 1;
+}
+
+// Backward shift deletion, linear probing needs no tombstones
+static void var_slot_remove(Compiler *com, VarSlot *slot)
+{
+    size_t mask = com->var_slots.capacity - 1;
+    size_t hole = (size_t)(slot - com->var_slots.items);
+    for(size_t i = (hole + 1) & mask; com->var_slots.items[i].name != 0; i = (i + 1) & mask) {
+        size_t home = var_slot_home(com, com->var_slots.items[i].name);
+        // Move the entry into the hole unless its home lies in (hole, i]
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            com->var_slots.items[hole] = com->var_slots.items[i];
+            hole = i;
         }
     }
-    return NULL;
+    com->var_slots.items[hole] = (VarSlot) {0};
+    com->var_slots.count -= 1;
+}
+
+static void var_slots_grow(Compiler *com)
+{
+    VarSlot *old_items = com->var_slots.items;
+    size_t old_capacity = com->var_slots.capacity;
+    com->var_slots.capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    com->var_slots.items = calloc(com->var_slots.capacity, sizeof(*com->var_slots.items));
+    assert(com->var_slots.items != NULL && "Buy more RAM LOL!");
+    com->var_slots.count = 0;
+    for(size_t i = 0; i < old_capacity; ++i) {
+        if(old_items[i].name != 0) var_slot_insert(com, old_items[i].name, old_items[i].var);
+    }
+    free(old_items);
+}
+
+// The innermost binding of name, or NULL
+Var *find_var(const Compiler *com, uint32_t name)
+{
+    VarSlot *slot = var_slot_find(com, name);
+    return slot == NULL ? NULL : &com->vars.items[slot->var];
 }
 
-Var *alloc_var(Compiler *com, const char *name)
+// Whether var was bound by the innermost scope
+bool var_in_current_scope(const Compiler *com, const Var *var)
 {
+    size_t scope_begin = com->scopes.count > 0 ? com->scopes.items[com->scopes.count - 1] : 0;
+    return (size_t)(var - com->vars.items) >= scope_begin;
+}
+
+Var *alloc_var(Compiler *com, uint32_t name)
+{
+    if(2 * (com->var_slots.count + 1) > com->var_slots.capacity) var_slots_grow(com);
     Var b = (Var){ .name = name, .index = com->vars.count };
+    uint32_t index = (uint32_t)com->vars.count;
+    VarSlot *slot = var_slot_find(com, name);
+    if(slot != NULL) {
+        b.shadowed = slot->var + 1;
+        slot->var = index;
+    } else {
+        var_slot_insert(com, name, index);
+    }
     nob_da_append(&com->vars, b);
     return &com->vars.items[com->vars.count - 1];
 }
 
-Var *alloc_var_local(Compiler *com, const char *name, size_t index)
+void scope_push(Compiler *com)
+{
+    nob_da_append(&com->scopes, com->vars.count);
+}
+
+// Unbinds everything bound since the matching scope_push(), the cost is
+// the number of those bindings and not the number in scope
+void scope_pop(Compiler *com)
+{
+    assert(com->scopes.count > 0 && "Popping a scope that was never pushed");
+    size_t scope_begin = com->scopes.items[--com->scopes.count];
+    while(com->vars.count > scope_begin) {
+        Var *var = &com->vars.items[--com->vars.count];
+        VarSlot *slot = var_slot_find(com, var->name);
+        assert(slot != NULL && slot->var == com->vars.count);
+        if(var->shadowed > 0) slot->var = (uint32_t)(var->shadowed - 1);
+        else var_slot_remove(com, slot);
+    }
+}
+
+Var *alloc_var_local(Compiler *com, uint32_t name, size_t index)
 {
     Var *local = alloc_var(com, name);
-    local->name = name;
     local->storage = VAR_LOCAL;
     local->index = index;
     return local;
 }
 
-typedef struct CompileExprResult {
-    Arg  arg;
-    bool lvalue;
-} CompileExprResult;
+// CONSTANT FOLDING
+
+// Evaluates a binary operation the way the generated code would, with
+// 64 bit two's complement wrapping. Fails only on division by zero.
+static bool fold_binop(InstKind kind, int64_t a, int64_t b, int64_t *result)
+{
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch(kind) {
+        case INST_ADD: *result = (int64_t)(ua + ub); return true;
+        case INST_SUB: *result = (int64_t)(ua - ub); return true;
+        case INST_MUL: *result = (int64_t)(ua * ub); return true;
+        case INST_DIV:
+        case INST_MOD:
+            if(b == 0) return false;
+            // idiv would trap here, the wrapped result is what C compilers fold it to
+            if(a == INT64_MIN && b == -1) *result = kind == INST_DIV ? INT64_MIN : 0;
+            else *result = kind == INST_DIV ? a / b : a % b;
+            return true;
+        // Shift counts are taken modulo 64 like x86 does
+        case INST_SHL: *result = (int64_t)(ua << (ub & 63)); return true;
+        case INST_SHR:
+            // Arithmetic, spelled out since >> of a negative number is implementation-defined
+            *result = a < 0 ? (int64_t)~(~ua >> (ub & 63)) : (int64_t)(ua >> (ub & 63));
+            return true;
+        case INST_AND: *result = (int64_t)(ua & ub); return true;
+        case INST_OR:  *result = (int64_t)(ua | ub); return true;
+        case INST_LT: *result = a <  b; return true;
+        case INST_LE: *result = a <= b; return true;
+        case INST_GT: *result = a >  b; return true;
+        case INST_GE: *result = a >= b; return true;
+        case INST_EQ: *result = a == b; return true;
+        case INST_NE: *result = a != b; return true;
+        default:
+            assert(0 && "Not a binary operation");
+    }
+    return false;
+}
+
+// Operations with a literal that leave the other operand as it is
+static bool binop_is_identity(InstKind kind, int64_t literal, bool literal_on_left)
+{
+    switch(kind) {
+        case INST_ADD:
+        case INST_OR:  return literal == 0;
+        case INST_MUL: return literal == 1;
+        case INST_SUB:
+        case INST_SHL:
+        case INST_SHR: return !literal_on_left && literal == 0;
+        case INST_DIV: return !literal_on_left && literal == 1;
+        default:       return false;
+    }
+}
+
+// Adds a NODE_BINOP, or whatever it reduces to when literals are involved,
+// so the IR never operates on two literals
+static bool push_binop(AstFunction *fn, InstKind kind, Loc loc, NodeId a, NodeId b, NodeId *result)
+{
+    Ast *ast = &fn->ast;
+    const Node *lhs = ast_node(ast, a);
+    const Node *rhs = ast_node(ast, b);
+    if(lhs->kind == NODE_INT && rhs->kind == NODE_INT) {
+        int64_t value = 0;
+        if(!fold_binop(kind, lhs->int_value, rhs->int_value, &value)) {
+            compiler_diagf(loc, "Division by zero in a constant expression");
+            return false;
+        }
+        *result = ast_push_node(ast, (Node) { .kind = NODE_INT, .loc = loc, .int_value = value });
+        return true;
+    }
+    // (x +- c1) +- c2 is x +- (c1 +- c2)
+    if((kind == INST_ADD || kind == INST_SUB) && rhs->kind == NODE_INT &&
+       lhs->kind == NODE_BINOP && (lhs->op == INST_ADD || lhs->op == INST_SUB) && ast_node(ast, lhs->b)->kind == NODE_INT) {
+        uint64_t c1 = (uint64_t)ast_node(ast, lhs->b)->int_value;
+        uint64_t c2 = (uint64_t)rhs->int_value;
+        uint64_t offset = (lhs->op == INST_ADD ? c1 : 0 - c1) + (kind == INST_ADD ? c2 : 0 - c2);
+        NodeId x = lhs->a;
+        InstKind sum_kind = INST_ADD;
+        if((int64_t)offset < 0 && (int64_t)offset != INT64_MIN) {
+            sum_kind = INST_SUB;
+            offset = 0 - offset;
+        }
+        NodeId sum = ast_push_node(ast, (Node) { .kind = NODE_INT, .loc = rhs->loc, .int_value = (int64_t)offset });
+        return push_binop(fn, sum_kind, loc, x, sum, result);
+    }
+    // x * 0 and x & 0 drop x, which is fine as long as reading it does nothing else
+    if((kind == INST_MUL || kind == INST_AND) &&
+       ((lhs->kind == NODE_INT && lhs->int_value == 0 && rhs->kind == NODE_VAR) ||
+        (rhs->kind == NODE_INT && rhs->int_value == 0 && lhs->kind == NODE_VAR))) {
+        *result = ast_push_node(ast, (Node) { .kind = NODE_INT, .loc = loc, .int_value = 0 });
+        return true;
+    }
+    if(lhs->kind == NODE_INT && binop_is_identity(kind, lhs->int_value, true)) {
+        ast_node(ast, b)->folded = 1;
+        *result = b;
+        return true;
+    }
+    if(rhs->kind == NODE_INT && binop_is_identity(kind, rhs->int_value, false)) {
+        ast_node(ast, a)->folded = 1;
+        *result = a;
+        return true;
+    }
+    *result = ast_push_node(ast, (Node) { .kind = NODE_BINOP, .op = (uint8_t)kind, .loc = loc, .a = a, .b = b });
+    return true;
+}
 
-bool compile_expression(Compiler *com, Function *fn, Lexer *lex, CompileExprResult *result);
-bool compile_binop_or_primary_expression(Compiler *com, Function *fn, Lexer *lex, CompileExprResult *result);
+bool parse_expression(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result);
+bool parse_conditional_expression(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result);
 
-bool compile_primary_expression(Compiler *com, Function *fn, Lexer *lex, CompileExprResult *result)
+bool parse_primary_expression(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result)
 {
     assert(result);
-    lexer_get_token(lex);
+    lexer_advance(lex);
     Loc loc = lex->loc;
+    Ast *ast = &fn->ast;
     switch(lex->token) {
         case TOKEN_INT_LIT:
-            result->arg = MAKE_INT_VALUE_ARG(lex->int_number);
-            result->lvalue = false;
+            *result = ast_push_node(ast, (Node) { .kind = NODE_INT, .loc = loc, .int_value = lex->int_number });
             return true;
+        case TOKEN_FLOAT_LIT:
+            compiler_missingf(loc, "float literals in expressions");
+            return false;
         case TOKEN_MUL:
             {
-                if(!compile_primary_expression(com, fn, lex, result)) return false;
-                size_t index = alloc_local(fn);
-                push_inst(fn, (Inst) {
-                    .kind = INST_LOCAL_ASSIGN,
-                    .loc = loc,
-                    .args[0] = MAKE_LOCAL_INDEX_ARG(index),
-                    .args[1] = result->arg,
-                });
-                result->lvalue = true;
-                result->arg = MAKE_DEREF_ARG(index);
+                NodeId operand = 0;
+                if(!parse_primary_expression(com, fn, lex, &operand)) return false;
+                *result = ast_push_node(ast, (Node) { .kind = NODE_DEREF, .loc = loc, .a = operand });
                 return true;
             } break;
+        case TOKEN_MINUS:
+        case TOKEN_NOT:
+            {
+                // -a is 0 - a and !a is a == 0, the IR has no unary operations
+                Token token = lex->token;
+                NodeId operand = 0;
+                if(!parse_primary_expression(com, fn, lex, &operand)) return false;
+                NodeId zero = ast_push_node(ast, (Node) { .kind = NODE_INT, .loc = loc, .int_value = 0 });
+                if(token == TOKEN_MINUS) return push_binop(fn, INST_SUB, loc, zero, operand, result);
+                return push_binop(fn, INST_EQ, loc, operand, zero, result);
+            } break;
+        case TOKEN_OPAREN:
+            if(!parse_expression(com, fn, lex, result)) return false;
+            return lexer_get_and_expect_token(lex, TOKEN_CPAREN);
         case TOKEN_STRING_LIT:
-            result->arg = MAKE_STATIC_DATA_ARG(com->static_data.count);
-            result->lvalue = false;
-            nob_sb_append_cstr(&com->static_data, lex->string);
+            *result = ast_push_node(ast, (Node) { .kind = NODE_STRING, .loc = loc, .static_offset = com->static_data.count });
+            nob_sb_append_buf(&com->static_data, lex->string, lex->string_length);
             nob_da_append(&com->static_data, 0);
             return true;
         case TOKEN_ID:
             {
-                ParsePoint saved_point = lex->parse_point;
-                char *name = arena_strdup(&com->arena, lex->string);
-                if(!lexer_get_token(lex)) return false;
-                if(lex->token == TOKEN_OPAREN) {
-                    CompileExprResult expr = {0};
-                    ArgList args = {0};
-                    ParsePoint saved_point = lex->parse_point;
-                    lexer_get_token(lex);
-                    while(true) {
-                        if(lex->token == TOKEN_CPAREN) break;
-                        lex->parse_point = saved_point;
-                        if(!compile_binop_or_primary_expression(com, fn, lex, &expr)) return false;
-                        arena_da_append(&com->arena, &args, expr.arg);
-                        lexer_get_token(lex);
-                        if(lex->token == TOKEN_CPAREN) break;
-                        if(!lexer_expect_token(lex, TOKEN_COMMA)) return false;
-                        saved_point = lex->parse_point;
-                        lexer_get_token(lex);
+                uint32_t name = lex->id;
+                if(lexer_peek_token(lex, 0) == TOKEN_OPAREN) {
+                    lexer_advance(lex);
+                    size_t mark = com->pending_nodes.count;
+                    while(lexer_peek_token(lex, 0) != TOKEN_CPAREN) {
+                        NodeId arg = 0;
+                        if(!parse_conditional_expression(com, fn, lex, &arg)) return false;
+                        nob_da_append(&com->pending_nodes, arg);
+                        if(lexer_peek_token(lex, 0) == TOKEN_CPAREN) break;
+                        if(!lexer_get_and_expect_token(lex, TOKEN_COMMA)) return false;
                     }
-                    lexer_expect_token(lex, TOKEN_CPAREN);
-                    size_t index = alloc_local(fn);
-                    push_inst(fn, (Inst){
-                        .loc = loc,
-                        .kind = INST_FUNCALL,
-                        .args[0] = MAKE_LOCAL_INDEX_ARG(index),
-                        .args[1] = MAKE_NAME_ARG(name),
-                        .args[2] = MAKE_LIST_ARG(args),
-                    });
-                    result->arg = MAKE_LOCAL_INDEX_ARG(index);
-                    result->lvalue = true;
+                    if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
+                    NodeList args = ast_push_list(ast, com->pending_nodes.items + mark, com->pending_nodes.count - mark);
+                    com->pending_nodes.count = mark;
+                    *result = ast_push_node(ast, (Node) { .kind = NODE_CALL, .loc = loc, .name = name, .list = args });
                 } else {
-                    lex->parse_point = saved_point;
                     Var *var = find_var(com, name);
                     if(var == NULL) {
-                        compiler_diagf(lex->loc, "Could not find %s in scope", lex->string);
+                        compiler_diagf(lex->loc, "Could not find %s in scope", interned_cstr(name));
                         return false;
                     }
                     if(var->storage != VAR_LOCAL) {
-                        compiler_diagf(lex->loc, "Variable %s is not a local variable", var->name);
+                        compiler_diagf(lex->loc, "Variable %s is not a local variable", interned_cstr(var->name));
                         return false;
                     }
-                    result->arg = MAKE_LOCAL_INDEX_ARG(var->index);
-                    result->lvalue = true;
+                    *result = ast_push_node(ast, (Node) { .kind = NODE_VAR, .loc = loc, .var = (uint32_t)var->index });
                 }
                 return true;
             }
@@ -159,304 +387,952 @@ InstKind token_to_binop_inst_kind(Token token)
         case TOKEN_PLUS:  return INST_ADD;
         case TOKEN_MINUS: return INST_SUB;
         case TOKEN_MUL:  return INST_MUL;
+        case TOKEN_DIV:  return INST_DIV;
+        case TOKEN_MOD:  return INST_MOD;
+        case TOKEN_SHL:  return INST_SHL;
+        case TOKEN_SHR:  return INST_SHR;
         case TOKEN_LESS:  return INST_LT;
         case TOKEN_LESSEQ:  return INST_LE;
         case TOKEN_GREATER:  return INST_GT;
         case TOKEN_GREATEREQ:  return INST_GE;
         case TOKEN_EQEQ:  return INST_EQ;
         case TOKEN_NOTEQ:  return INST_NE;
+        case TOKEN_AND:  return INST_AND;
+        case TOKEN_OR:  return INST_OR;
         default: return INST_NOP;
     }
 }
 
-bool compile_binop_or_primary_expression(Compiler *com, Function *fn, Lexer *lex, CompileExprResult *result)
+// Binding power of a binary operator as in C, 0 for anything else. All of
+// them group from the left.
+int token_binop_precedence(Token token)
 {
-    CompileExprResult lhs = {0};
-    if(!compile_primary_expression(com, fn, lex, &lhs)) return false;
-
-    ParsePoint saved_point = lex->parse_point;
-    lexer_get_token(lex);
-    InstKind inst_kind = token_to_binop_inst_kind(lex->token);
-    if(inst_kind != INST_NOP) {
-        CompileExprResult result_expr = {0};
-        result_expr.arg = MAKE_LOCAL_INDEX_ARG(alloc_local(fn));
-        while((inst_kind = token_to_binop_inst_kind(lex->token)) != INST_NOP) {
-            CompileExprResult rhs = {0};
-            if(!compile_primary_expression(com, fn, lex, &rhs)) return false;
-            push_inst(fn, (Inst) {
-                .kind = inst_kind,
-                .args[0] = result_expr.arg,
-                .args[1] = lhs.arg,
-                .args[2] = rhs.arg,
-            });
-            lhs = result_expr;
-            saved_point = lex->parse_point;
-            lexer_get_token(lex);
-        }
-        *result = result_expr;
-    } else {
-        *result = lhs;
+    switch(token) {
+        case TOKEN_OR:        return 1;
+        case TOKEN_AND:       return 2;
+        case TOKEN_EQEQ:
+        case TOKEN_NOTEQ:     return 3;
+        case TOKEN_LESS:
+        case TOKEN_LESSEQ:
+        case TOKEN_GREATER:
+        case TOKEN_GREATEREQ: return 4;
+        case TOKEN_SHL:
+        case TOKEN_SHR:       return 5;
+        case TOKEN_PLUS:
+        case TOKEN_MINUS:     return 6;
+        case TOKEN_MUL:
+        case TOKEN_DIV:
+        case TOKEN_MOD:       return 7;
+        default:              return 0;
     }
-    lex->parse_point = saved_point;
+}
 
+// Precedence climbing: parses operators that bind at least as tightly as
+// min_precedence, the right operand of each only takes tighter ones
+bool parse_binary_expression(Compiler *com, AstFunction *fn, Lexer *lex, int min_precedence, NodeId *result)
+{
+    NodeId lhs = 0;
+    if(!parse_primary_expression(com, fn, lex, &lhs)) return false;
+
+    int precedence;
+    while((precedence = token_binop_precedence(lexer_peek_token(lex, 0))) >= min_precedence && precedence > 0) {
+        lexer_advance(lex);
+        Loc loc = lex->loc;
+        InstKind inst_kind = token_to_binop_inst_kind(lex->token);
+        NodeId rhs = 0;
+        if(!parse_binary_expression(com, fn, lex, precedence + 1, &rhs)) return false;
+        if(!push_binop(fn, inst_kind, loc, lhs, rhs, &lhs)) return false;
+    }
+    *result = lhs;
     return true;
 }
 
-bool compile_expression(Compiler *com, Function *fn, Lexer *lex, CompileExprResult *result)
+// a ? b : c, grouping from the right
+bool parse_conditional_expression(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result)
 {
+    if(!parse_binary_expression(com, fn, lex, 1, result)) return false;
+    if(lexer_peek_token(lex, 0) != TOKEN_QUESTION) return true;
+    lexer_advance(lex);
     Loc loc = lex->loc;
-    if(!compile_binop_or_primary_expression(com, fn, lex, result)) return false;
-    ParsePoint saved_point = lex->parse_point;
-    if(!lexer_get_token(lex)) return false;
-    if(lex->token == TOKEN_EQ) {
+    NodeId then = 0, otherwise = 0;
+    if(!parse_expression(com, fn, lex, &then)) return false;
+    if(!lexer_get_and_expect_token(lex, TOKEN_COLON)) return false;
+    if(!parse_conditional_expression(com, fn, lex, &otherwise)) return false;
+    // Only the branch taken is ever evaluated, so a literal condition picks it
+    const Node *cond = ast_node(&fn->ast, *result);
+    if(cond->kind == NODE_INT) {
+        *result = cond->int_value != 0 ? then : otherwise;
+        ast_node(&fn->ast, *result)->folded = 1;
+        return true;
+    }
+    *result = ast_push_node(&fn->ast, (Node) { .kind = NODE_COND, .loc = loc, .a = *result, .b = then, .c = otherwise });
+    return true;
+}
+
+static bool node_is_lvalue(const Node *node)
+{
+    if(node->folded) return false;
+    return node->kind == NODE_VAR || node->kind == NODE_DEREF || node->kind == NODE_CALL;
+}
+
+// The binop of a compound assignment like +=, INST_NOP for anything else
+static InstKind token_to_update_inst_kind(Token token)
+{
+    switch(token) {
+        case TOKEN_PLUSEQ:  return INST_ADD;
+        case TOKEN_MINUSEQ: return INST_SUB;
+        case TOKEN_MULEQ:   return INST_MUL;
+        case TOKEN_DIVEQ:   return INST_DIV;
+        case TOKEN_MODEQ:   return INST_MOD;
+        case TOKEN_SHLEQ:   return INST_SHL;
+        case TOKEN_SHREQ:   return INST_SHR;
+        case TOKEN_ANDEQ:   return INST_AND;
+        case TOKEN_OREQ:    return INST_OR;
+        default:            return INST_NOP;
+    }
+}
 
-        if(!result->lvalue) {
+bool parse_expression(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result)
+{
+    if(!parse_conditional_expression(com, fn, lex, result)) return false;
+    Token token = lexer_peek_token(lex, 0);
+    InstKind op = token_to_update_inst_kind(token);
+    if(token == TOKEN_EQ || op != INST_NOP) {
+        lexer_advance(lex);
+        const Node *lhs = ast_node(&fn->ast, *result);
+        Loc loc = lhs->loc;
+        // A call has nothing to read back, so it only takes a plain =
+        if(!node_is_lvalue(lhs) || (op != INST_NOP && lhs->kind == NODE_CALL)) {
             compiler_diagf(loc, "Invalid assignment to rvalue\n");
             return false;
         }
 
-        CompileExprResult rhs = {0};
-        if(!compile_expression(com, fn, lex, &rhs)) return false;
-        InstKind inst_kind = INST_NOP;
-        switch(result->arg.kind) {
-            case ARG_LOCAL_INDEX:
-                inst_kind = INST_LOCAL_ASSIGN;
-                break;
-            case ARG_DEREF:
-                inst_kind = INST_STORE;
-                break;
-            default:
-                break;
+        NodeId rhs = 0;
+        if(!parse_expression(com, fn, lex, &rhs)) return false;
+        *result = ast_push_node(&fn->ast, (Node) { .kind = NODE_ASSIGN, .op = (uint8_t)op, .loc = loc, .a = *result, .b = rhs });
+    }
+    return true;
+}
+
+bool parse_block(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result);
+
+// With the `if` current, the `else if`s of a chain nest in c
+bool parse_if(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result)
+{
+    Loc loc = lex->loc;
+    NodeId cond = 0, then = 0, otherwise = 0;
+    if(!lexer_get_and_expect_token(lex, TOKEN_OPAREN)) return false;
+    if(!parse_expression(com, fn, lex, &cond)) return false;
+    if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
+    if(!lexer_get_and_expect_token(lex, TOKEN_OCURLY)) return false;
+    if(!parse_block(com, fn, lex, &then)) return false;
+    if(lexer_peek_token(lex, 0) == TOKEN_ELSE) {
+        lexer_advance(lex);
+        if(lexer_peek_token(lex, 0) == TOKEN_IF) {
+            lexer_advance(lex);
+            if(!parse_if(com, fn, lex, &otherwise)) return false;
+        } else {
+            if(!lexer_get_and_expect_token(lex, TOKEN_OCURLY)) return false;
+            if(!parse_block(com, fn, lex, &otherwise)) return false;
         }
+    }
+    *result = ast_push_node(&fn->ast, (Node) { .kind = NODE_IF, .loc = loc, .a = cond, .b = then, .c = otherwise });
+    return true;
+}
 
-        if(inst_kind == INST_NOP) {
-            compiler_diagf(loc, "Something went wrong at implemented in compiler source %s:%zu\n", __FILE__, __LINE__);
-            return false;
+bool parse_statement(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result)
+{
+    switch(lexer_peek_token(lex, 0)) {
+        case TOKEN_IF:
+            lexer_advance(lex);
+            return parse_if(com, fn, lex, result);
+        case TOKEN_WHILE:
+            {
+                lexer_advance(lex);
+                Loc loc = lex->loc;
+                NodeId cond = 0, body = 0;
+                if(!lexer_get_and_expect_token(lex, TOKEN_OPAREN)) return false;
+                if(!parse_expression(com, fn, lex, &cond)) return false;
+                if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
+                if(!lexer_get_and_expect_token(lex, TOKEN_OCURLY)) return false;
+                if(!parse_block(com, fn, lex, &body)) return false;
+                *result = ast_push_node(&fn->ast, (Node) { .kind = NODE_WHILE, .loc = loc, .a = cond, .b = body });
+                return true;
+            }
+        case TOKEN_EXTERN:
+            {
+                lexer_advance(lex);
+                Loc loc = lex->loc;
+                if(!lexer_get_and_expect_token(lex, TOKEN_ID)) return false;
+                *result = ast_push_node(&fn->ast, (Node) { .kind = NODE_EXTERN, .loc = loc, .name = lex->id });
+                return lexer_get_and_expect_token(lex, TOKEN_SEMICOLON);
+            }
+        default:
+            if(!parse_expression(com, fn, lex, result)) return false;
+            return lexer_get_and_expect_token(lex, TOKEN_SEMICOLON);
+    }
+}
+
+// With the opening curly current. Leaves the closing curly (or whatever
+// ended the block) current.
+bool parse_block(Compiler *com, AstFunction *fn, Lexer *lex, NodeId *result)
+{
+    Loc loc = lex->loc;
+    scope_push(com);
+    size_t mark = com->pending_nodes.count;
+    Token next;
+    while((next = lexer_peek_token(lex, 0)) != TOKEN_CCURLY && next != TOKEN_EOF && next != TOKEN_PARSING_ERROR) {
+        NodeId stmt = 0;
+        if(!parse_statement(com, fn, lex, &stmt)) return false;
+        nob_da_append(&com->pending_nodes, stmt);
+    }
+    lexer_advance(lex);
+    scope_pop(com);
+
+    NodeList stmts = ast_push_list(&fn->ast, com->pending_nodes.items + mark, com->pending_nodes.count - mark);
+    com->pending_nodes.count = mark;
+    *result = ast_push_node(&fn->ast, (Node) { .kind = NODE_BLOCK, .loc = loc, .list = stmts });
+    return true;
+}
+
+// Binds the identifier lex is at as the next variable of fn
+static bool declare_function_var(Compiler *com, AstFunction *fn, Lexer *lex)
+{
+    Var *existing = find_var(com, lex->id);
+    if(existing != NULL && var_in_current_scope(com, existing)) {
+        compiler_diagf(lex->loc, "Variable with name `%s` is already exists", interned_cstr(lex->id));
+        return false;
+    }
+    alloc_var_local(com, lex->id, fn->count_vars++);
+    return true;
+}
+
+bool parse_function(Compiler *com, AstFunction *fn, Lexer *lex)
+{
+    fn->loc = lex->loc;
+    fn->static_begin = com->static_data.count;
+    fn->static_end = com->static_data.count;
+    if(!lexer_expect_token(lex, TOKEN_FUNCTION)) return false;
+    if(!lexer_get_and_expect_token(lex, TOKEN_ID)) return false;
+    fn->name  = lex->id;
+
+    if(!lexer_get_and_expect_token(lex, TOKEN_OPAREN)) return false;
+    while(lexer_peek_token(lex, 0) != TOKEN_CPAREN) {
+        if(!lexer_get_and_expect_token(lex, TOKEN_ID)) return false;
+        if(!declare_function_var(com, fn, lex)) return false;
+        fn->count_params += 1;
+        if(lexer_peek_token(lex, 0) == TOKEN_CPAREN) break;
+        if(!lexer_get_and_expect_token(lex, TOKEN_COMMA)) return false;
+    }
+    if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
+
+    if(!lexer_advance(lex)) return false;
+    if(lex->token == TOKEN_COLON) {
+        if(!lexer_get_and_expect_token(lex, TOKEN_ID)) return false;
+        while(lex->token == TOKEN_ID) {
+            if(!declare_function_var(com, fn, lex)) return false;
+            lexer_advance(lex);
+            if(lex->token == TOKEN_COMMA) lexer_advance(lex);
         }
-        push_inst(fn, (Inst) {
-            .loc = loc,
-            .kind = inst_kind,
-            .args[0] = result->arg,
-            .args[1] = rhs.arg,
-        });
-    } else {
-        lex->parse_point = saved_point;
     }
+
+    if(!lexer_expect_token(lex, TOKEN_OCURLY)) return false;
+    if(!parse_block(com, fn, lex, &fn->body)) return false;
+    if(!lexer_expect_token(lex, TOKEN_CCURLY)) return false;
+    fn->static_end = com->static_data.count;
     return true;
 }
 
-bool compile_block(Compiler *com, Function *fn, Lexer *lex)
+// IR LOWERING
+
+static size_t temp_alloc(Compiler *com, Function *fn)
 {
-    ParsePoint saved_point = lex->parse_point;
-    while(lexer_get_token(lex) && lex->token != TOKEN_CCURLY) {
-        Loc stmt_loc = lex->loc;
-        switch(lex->token) {
-            case TOKEN_IF:
-                {
-                    CompileExprResult expr = {0};
-                    if(!lexer_get_and_expect_token(lex, TOKEN_OPAREN)) return false;
-                    if(!compile_expression(com, fn, lex, &expr)) return false;
-                    if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
-                    size_t then_label  = alloc_label(fn);
-                    size_t next_label = alloc_label(fn);
-                    Inst *inst = push_inst(fn, (Inst) {
-                        .loc  = stmt_loc,
-                        .kind = INST_BRANCH,
-                        .args[0] = MAKE_LABEL_ARG(then_label),
-                        .args[1] = MAKE_LABEL_ARG(next_label),
-                        .args[2] = expr.arg,
-                    });
-                    if(!lexer_get_and_expect_token(lex, TOKEN_OCURLY)) return false;
+    if(com->free_temps.count > 0) return com->free_temps.items[--com->free_temps.count];
+    return alloc_local(fn);
+}
+
+// Hands the temporary behind a value back once its only reader is emitted.
+// Variables, literals and static data are not temporaries.
+static void temp_release(Compiler *com, Arg arg)
+{
+    size_t index;
+    switch(arg.kind) {
+        case ARG_LOCAL_INDEX: index = arg.local_index; break;
+        case ARG_DEREF:       index = arg.deref_local_index; break;
+        default: return;
+    }
+    if(index >= com->first_temp) nob_da_append(&com->free_temps, index);
+}
+
+// Whether kind can be the op of an INST_UPDATE
+static bool inst_kind_updates(InstKind kind)
+{
+    switch(kind) {
+        case INST_ADD:
+        case INST_SUB:
+        case INST_MUL:
+        case INST_DIV:
+        case INST_MOD:
+        case INST_SHL:
+        case INST_SHR:
+        case INST_AND:
+        case INST_OR:  return true;
+        default:       return false;
+    }
+}
+
+// The result is owned by the caller, who releases it with temp_release()
+bool lower_expression(Compiler *com, Function *fn, const Ast *ast, NodeId id, Arg *result)
+{
+    const Node *node = ast_node(ast, id);
+    switch(node->kind) {
+        case NODE_INT:
+            *result = MAKE_INT_VALUE_ARG(node->int_value);
+            return true;
+        case NODE_STRING:
+            *result = MAKE_STATIC_DATA_ARG(node->static_offset);
+            return true;
+        case NODE_VAR:
+            // Variables take the first locals of the function, in order
+            *result = MAKE_LOCAL_INDEX_ARG(node->var);
+            return true;
+        case NODE_DEREF:
+            {
+                Arg operand = {0};
+                if(!lower_expression(com, fn, ast, node->a, &operand)) return false;
+                // A pointer already sitting in a local is dereferenced in place
+                if(operand.kind == ARG_LOCAL_INDEX) {
+                    *result = MAKE_DEREF_ARG(operand.local_index);
+                    return true;
+                }
+                temp_release(com, operand);
+                size_t index = temp_alloc(com, fn);
+                push_inst(fn, (Inst) {
+                    .kind = INST_LOCAL_ASSIGN,
+                    .loc = node->loc,
+                    .args[0] = MAKE_LOCAL_INDEX_ARG(index),
+                    .args[1] = operand,
+                });
+                *result = MAKE_DEREF_ARG(index);
+                return true;
+            }
+        case NODE_CALL:
+            {
+                ArgList args = {0};
+                for(size_t i = 0; i < node->list.count; ++i) {
+                    Arg arg = {0};
+                    if(!lower_expression(com, fn, ast, ast_child(ast, node->list, i), &arg)) return false;
+                    arena_da_append(&com->arena, &args, arg);
+                }
+                // Arguments are all read before the result is written
+                for(size_t i = 0; i < args.count; ++i) temp_release(com, args.items[i]);
+                size_t index = temp_alloc(com, fn);
+                push_inst(fn, (Inst){
+                    .loc = node->loc,
+                    .kind = INST_FUNCALL,
+                    .args[0] = MAKE_LOCAL_INDEX_ARG(index),
+                    .args[1] = MAKE_NAME_ARG(node->name),
+                    .args[2] = MAKE_LIST_ARG(args),
+                });
+                *result = MAKE_LOCAL_INDEX_ARG(index);
+                return true;
+            }
+        case NODE_BINOP:
+            {
+                // Both operands are read before the result is written, so
+                // the result may take the place of either of them
+                Arg lhs = {0}, rhs = {0};
+                if(!lower_expression(com, fn, ast, node->a, &lhs)) return false;
+                if(!lower_expression(com, fn, ast, node->b, &rhs)) return false;
+                temp_release(com, lhs);
+                temp_release(com, rhs);
+                Arg dst = MAKE_LOCAL_INDEX_ARG(temp_alloc(com, fn));
+                push_inst(fn, (Inst) {
+                    .loc = node->loc,
+                    .kind = (InstKind)node->op,
+                    .args[0] = dst,
+                    .args[1] = lhs,
+                    .args[2] = rhs,
+                });
+                *result = dst;
+                return true;
+            }
+        case NODE_ASSIGN:
+            {
+                Arg rhs = {0};
+                if(!lower_expression(com, fn, ast, node->a, result)) return false;
+                if(!lower_expression(com, fn, ast, node->b, &rhs)) return false;
+
+                // x op= y is a single read-modify-write of x
+                if(node->op != INST_NOP) {
+                    if(rhs.kind == ARG_INT_VALUE && binop_is_identity((InstKind)node->op, rhs.int_value, false)) return true;
                     push_inst(fn, (Inst) {
-                        .loc  = stmt_loc,
-                        .kind = INST_LABEL,
-                        .args[0] = MAKE_LABEL_ARG(then_label),
+                        .loc = node->loc,
+                        .kind = INST_UPDATE,
+                        .op = (InstKind)node->op,
+                        .args[0] = *result,
+                        .args[1] = rhs,
                     });
-                    if(!compile_block(com, fn, lex)) return false;
-                    ParsePoint saved_point = lex->parse_point;
-                    if(!lexer_get_token(lex)) return false;
-                    if(lex->token == TOKEN_ELSE) {
-                        size_t end_label = alloc_label(fn);
-                        push_inst(fn, (Inst) {
-                            .loc  = stmt_loc,
-                            .kind = INST_JMP,
-                            .args[0] = MAKE_LABEL_ARG(end_label),
-                        });
-                        while(lex->token == TOKEN_ELSE) {
-                            push_inst(fn, (Inst) {
-                                .loc  = stmt_loc,
-                                .kind = INST_LABEL,
-                                .args[0] = MAKE_LABEL_ARG(next_label),
-                            });
-                            if(!lexer_get_token(lex)) return false;
-                            bool should_break = true;
-                            if(lex->token == TOKEN_IF) {
-                                then_label = alloc_label(fn);
-                                next_label = alloc_label(fn);
-                                should_break = false;
-                                if(!lexer_get_and_expect_token(lex, TOKEN_OPAREN)) return false;
-                                if(!compile_expression(com, fn, lex, &expr)) return false;
-                                if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
-                                Inst *inst = push_inst(fn, (Inst) {
-                                    .loc  = stmt_loc,
-                                    .kind = INST_BRANCH,
-                                    .args[0] = MAKE_LABEL_ARG(then_label),
-                                    .args[1] = MAKE_LABEL_ARG(next_label),
-                                    .args[2] = expr.arg,
-                                });
-                                if(!lexer_get_token(lex)) return false;
-                                push_inst(fn, (Inst) {
-                                    .loc  = stmt_loc,
-                                    .kind = INST_LABEL,
-                                    .args[0] = MAKE_LABEL_ARG(then_label),
-                                });
-                            }
-                            if(!lexer_expect_token(lex, TOKEN_OCURLY)) return false;
-                            if(!compile_block(com, fn, lex)) return false;
-                            push_inst(fn, (Inst) {
-                                .loc  = stmt_loc,
-                                .kind = INST_JMP,
-                                .args[0] = MAKE_LABEL_ARG(end_label),
-                            });
-                            if(should_break) break;
-                            if(!lexer_get_token(lex)) return false;
+                    temp_release(com, rhs);
+                    return true;
+                }
+
+                // Folding may leave x = x behind
+                if(result->kind == ARG_LOCAL_INDEX && rhs.kind == ARG_LOCAL_INDEX && rhs.local_index == result->local_index) {
+                    return true;
+                }
+
+                // A value the last instruction just computed into a temporary
+                // is computed straight into the variable instead, and
+                // x = x op y is taken as x op= y
+                if(result->kind == ARG_LOCAL_INDEX && rhs.kind == ARG_LOCAL_INDEX && rhs.local_index >= com->first_temp) {
+                    Inst *last = &fn->items[fn->count - 1];
+                    bool computes = last->kind == INST_FUNCALL || (INST_ADD <= last->kind && last->kind <= INST_OR);
+                    if(computes && last->args[0].kind == ARG_LOCAL_INDEX && last->args[0].local_index == rhs.local_index) {
+                        if(inst_kind_updates(last->kind) &&
+                           last->args[1].kind == ARG_LOCAL_INDEX && last->args[1].local_index == result->local_index) {
+                            last->op = last->kind;
+                            last->kind = INST_UPDATE;
+                            last->args[1] = last->args[2];
+                            last->args[2] = MAKE_NONE_ARG();
                         }
-                        push_inst(fn, (Inst) {
-                            .loc  = stmt_loc,
-                            .kind = INST_LABEL,
-                            .args[0] = MAKE_LABEL_ARG(end_label),
-                        });
-                    } else {
-                        lex->parse_point = saved_point;
-                        push_inst(fn, (Inst) {
-                            .loc  = stmt_loc,
-                            .kind = INST_JMP,
-                            .args[0] = MAKE_LABEL_ARG(next_label),
-                        });
-                        push_inst(fn, (Inst) {
-                            .loc  = stmt_loc,
-                            .kind = INST_LABEL,
-                            .args[0] = MAKE_LABEL_ARG(next_label),
-                        });
+                        last->args[0] = *result;
+                        temp_release(com, rhs);
+                        return true;
                     }
-                } break;
-            case TOKEN_WHILE:
-                {
-                    size_t start_label = fn->labels_count;
-                    size_t body_label  = fn->labels_count + 1;
-                    size_t end_label   = fn->labels_count + 2;
-                    lexer_get_and_expect_token(lex, TOKEN_OPAREN);
-                    push_inst(fn, (Inst) {
-                        .loc  = stmt_loc,
-                        .kind = INST_LABEL,
-                        .args[0] = MAKE_LABEL_ARG(start_label),
-                    });
+                }
 
-                    CompileExprResult expr = {0};
-                    if(!compile_expression(com, fn, lex, &expr)) return false;
-                    if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
-                    Inst *inst = push_inst(fn, (Inst) {
-                        .loc  = stmt_loc,
-                        .kind = INST_BRANCH,
-                        .args[0] = MAKE_LABEL_ARG(body_label),
-                        .args[1] = MAKE_LABEL_ARG(end_label),
-                        .args[2] = expr.arg,
-                    });
-                    if(!lexer_get_and_expect_token(lex, TOKEN_OCURLY)) return false;
+                InstKind inst_kind = INST_NOP;
+                switch(result->kind) {
+                    case ARG_LOCAL_INDEX:
+                        inst_kind = INST_LOCAL_ASSIGN;
+                        break;
+                    case ARG_DEREF:
+                        inst_kind = INST_STORE;
+                        break;
+                    default:
+                        break;
+                }
+
+                if(inst_kind == INST_NOP) {
+                    compiler_diagf(node->loc, "Something went wrong at implemented in compiler source %s:%zu\n", __FILE__, __LINE__);
+                    return false;
+                }
+                push_inst(fn, (Inst) {
+                    .loc = node->loc,
+                    .kind = inst_kind,
+                    .args[0] = *result,
+                    .args[1] = rhs,
+                });
+                temp_release(com, rhs);
+                return true;
+            }
+        case NODE_COND:
+            {
+                Arg cond = {0}, value = {0};
+                if(!lower_expression(com, fn, ast, node->a, &cond)) return false;
+                size_t then_label = alloc_label(fn);
+                size_t else_label = alloc_label(fn);
+                size_t end_label  = alloc_label(fn);
+                push_inst(fn, (Inst) {
+                    .loc  = node->loc,
+                    .kind = INST_BRANCH,
+                    .args[0] = MAKE_LABEL_ARG(then_label),
+                    .args[1] = MAKE_LABEL_ARG(else_label),
+                    .args[2] = cond,
+                });
+                temp_release(com, cond);
+                // Both branches leave their value in the same temporary
+                size_t index = temp_alloc(com, fn);
+                NodeId branches[2] = { node->b, node->c };
+                size_t labels[2] = { then_label, else_label };
+                for(size_t i = 0; i < 2; ++i) {
                     push_inst(fn, (Inst) {
-                        .loc  = stmt_loc,
+                        .loc  = node->loc,
                         .kind = INST_LABEL,
-                        .args[0] = MAKE_LABEL_ARG(body_label),
+                        .args[0] = MAKE_LABEL_ARG(labels[i]),
                     });
-                    if(!compile_block(com, fn, lex)) return false;
+                    if(!lower_expression(com, fn, ast, branches[i], &value)) return false;
                     push_inst(fn, (Inst) {
-                        .loc  = stmt_loc,
-                        .kind = INST_JMP,
-                        .args[0] = MAKE_LABEL_ARG(start_label),
+                        .loc  = node->loc,
+                        .kind = INST_LOCAL_ASSIGN,
+                        .args[0] = MAKE_LOCAL_INDEX_ARG(index),
+                        .args[1] = value,
                     });
+                    temp_release(com, value);
                     push_inst(fn, (Inst) {
-                        .loc  = stmt_loc,
-                        .kind = INST_LABEL,
+                        .loc  = node->loc,
+                        .kind = INST_JMP,
                         .args[0] = MAKE_LABEL_ARG(end_label),
                     });
-                    fn->labels_count += 3;
-                } break;
-            case TOKEN_EXTERN:
-                {
-                    lexer_get_and_expect_token(lex, TOKEN_ID);
-                    Inst inst = (Inst) {
-                        .loc = stmt_loc,
-                        .kind = INST_EXTERN,
-                        .args[0] = MAKE_NAME_ARG(arena_strdup(&com->arena, lex->string)),
-                    };
-                    push_inst(fn, inst);
-                    lexer_get_and_expect_token(lex, TOKEN_SEMICOLON);
-                } break;
-            default:
-                {
-                    CompileExprResult expr = {0};
-                    lex->parse_point = saved_point;
-                    if(!compile_expression(com, fn, lex, &expr)) return false;
-                    lexer_get_and_expect_token(lex, TOKEN_SEMICOLON);
-                } break;
-        }
-        saved_point = lex->parse_point;
+                }
+                push_inst(fn, (Inst) {
+                    .loc  = node->loc,
+                    .kind = INST_LABEL,
+                    .args[0] = MAKE_LABEL_ARG(end_label),
+                });
+                *result = MAKE_LOCAL_INDEX_ARG(index);
+                return true;
+            }
+        default:
+            assert(0 && "Not an expression node");
     }
+    return false;
+}
 
+bool lower_statement(Compiler *com, Function *fn, const Ast *ast, NodeId id);
+
+bool lower_if(Compiler *com, Function *fn, const Ast *ast, const Node *node)
+{
+    Loc stmt_loc = node->loc;
+    Arg cond = {0};
+    if(!lower_expression(com, fn, ast, node->a, &cond)) return false;
+    size_t then_label = alloc_label(fn);
+    size_t next_label = alloc_label(fn);
+    push_inst(fn, (Inst) {
+        .loc  = stmt_loc,
+        .kind = INST_BRANCH,
+        .args[0] = MAKE_LABEL_ARG(then_label),
+        .args[1] = MAKE_LABEL_ARG(next_label),
+        .args[2] = cond,
+    });
+    temp_release(com, cond);
+    push_inst(fn, (Inst) {
+        .loc  = stmt_loc,
+        .kind = INST_LABEL,
+        .args[0] = MAKE_LABEL_ARG(then_label),
+    });
+    if(!lower_statement(com, fn, ast, node->b)) return false;
+
+    if(node->c == 0) {
+        push_inst(fn, (Inst) {
+            .loc  = stmt_loc,
+            .kind = INST_JMP,
+            .args[0] = MAKE_LABEL_ARG(next_label),
+        });
+        push_inst(fn, (Inst) {
+            .loc  = stmt_loc,
+            .kind = INST_LABEL,
+            .args[0] = MAKE_LABEL_ARG(next_label),
+        });
+        return true;
+    }
+
+    // Every branch of the chain jumps to the same end
+    size_t end_label = alloc_label(fn);
+    push_inst(fn, (Inst) {
+        .loc  = stmt_loc,
+        .kind = INST_JMP,
+        .args[0] = MAKE_LABEL_ARG(end_label),
+    });
+    for(NodeId id = node->c; id != 0;) {
+        const Node *branch = ast_node(ast, id);
+        push_inst(fn, (Inst) {
+            .loc  = stmt_loc,
+            .kind = INST_LABEL,
+            .args[0] = MAKE_LABEL_ARG(next_label),
+        });
+        NodeId body = id;
+        id = 0;
+        if(branch->kind == NODE_IF) {
+            then_label = alloc_label(fn);
+            next_label = alloc_label(fn);
+            if(!lower_expression(com, fn, ast, branch->a, &cond)) return false;
+            push_inst(fn, (Inst) {
+                .loc  = stmt_loc,
+                .kind = INST_BRANCH,
+                .args[0] = MAKE_LABEL_ARG(then_label),
+                .args[1] = MAKE_LABEL_ARG(next_label),
+                .args[2] = cond,
+            });
+            temp_release(com, cond);
+            push_inst(fn, (Inst) {
+                .loc  = stmt_loc,
+                .kind = INST_LABEL,
+                .args[0] = MAKE_LABEL_ARG(then_label),
+            });
+            body = branch->b;
+            id = branch->c;
+        }
+        if(!lower_statement(com, fn, ast, body)) return false;
+        push_inst(fn, (Inst) {
+            .loc  = stmt_loc,
+            .kind = INST_JMP,
+            .args[0] = MAKE_LABEL_ARG(end_label),
+        });
+        // A chain without a final else falls through its last condition
+        if(branch->kind == NODE_IF && id == 0) {
+            push_inst(fn, (Inst) {
+                .loc  = stmt_loc,
+                .kind = INST_LABEL,
+                .args[0] = MAKE_LABEL_ARG(next_label),
+            });
+        }
+    }
+    push_inst(fn, (Inst) {
+        .loc  = stmt_loc,
+        .kind = INST_LABEL,
+        .args[0] = MAKE_LABEL_ARG(end_label),
+    });
     return true;
 }
 
-bool compile_function(Compiler *com, Function *fn, Lexer *lex, Nob_String_Builder *output)
+bool lower_statement(Compiler *com, Function *fn, const Ast *ast, NodeId id)
 {
-    fn->loc = lex->loc;
-    com->vars.count = 0;
-    if(!lexer_expect_token(lex, TOKEN_FUNCTION)) return false;
-    if(!lexer_get_and_expect_token(lex, TOKEN_ID)) return false;
-    fn->name  = arena_strdup(&com->arena, lex->string);
+    const Node *node = ast_node(ast, id);
+    Loc stmt_loc = node->loc;
+    switch(node->kind) {
+        case NODE_BLOCK:
+            for(size_t i = 0; i < node->list.count; ++i) {
+                if(!lower_statement(com, fn, ast, ast_child(ast, node->list, i))) return false;
+            }
+            return true;
+        case NODE_IF:
+            return lower_if(com, fn, ast, node);
+        case NODE_WHILE:
+            {
+                size_t start_label = alloc_label(fn);
+                size_t body_label  = alloc_label(fn);
+                size_t end_label   = alloc_label(fn);
+                push_inst(fn, (Inst) {
+                    .loc  = stmt_loc,
+                    .kind = INST_LABEL,
+                    .args[0] = MAKE_LABEL_ARG(start_label),
+                });
+                Arg cond = {0};
+                if(!lower_expression(com, fn, ast, node->a, &cond)) return false;
+                push_inst(fn, (Inst) {
+                    .loc  = stmt_loc,
+                    .kind = INST_BRANCH,
+                    .args[0] = MAKE_LABEL_ARG(body_label),
+                    .args[1] = MAKE_LABEL_ARG(end_label),
+                    .args[2] = cond,
+                });
+                temp_release(com, cond);
+                push_inst(fn, (Inst) {
+                    .loc  = stmt_loc,
+                    .kind = INST_LABEL,
+                    .args[0] = MAKE_LABEL_ARG(body_label),
+                });
+                if(!lower_statement(com, fn, ast, node->b)) return false;
+                push_inst(fn, (Inst) {
+                    .loc  = stmt_loc,
+                    .kind = INST_JMP,
+                    .args[0] = MAKE_LABEL_ARG(start_label),
+                });
+                push_inst(fn, (Inst) {
+                    .loc  = stmt_loc,
+                    .kind = INST_LABEL,
+                    .args[0] = MAKE_LABEL_ARG(end_label),
+                });
+                return true;
+            }
+        case NODE_EXTERN:
+            push_inst(fn, (Inst) {
+                .loc = stmt_loc,
+                .kind = INST_EXTERN,
+                .args[0] = MAKE_NAME_ARG(node->name),
+            });
+            return true;
+        default:
+            {
+                Arg ignored = {0};
+                if(!lower_expression(com, fn, ast, id, &ignored)) return false;
+                temp_release(com, ignored);
+                return true;
+            }
+    }
+}
 
-    if(!lexer_get_and_expect_token(lex, TOKEN_OPAREN)) return false;
-    if(!lexer_get_and_expect_token(lex, TOKEN_CPAREN)) return false;
+bool lower_function(Compiler *com, Function *fn, const AstFunction *ast_fn)
+{
+    fn->loc = ast_fn->loc;
+    fn->name = ast_fn->name;
+    fn->params_count = ast_fn->count_params;
+    fn->static_begin = ast_fn->static_begin;
+    fn->static_end = ast_fn->static_end;
+    for(size_t i = 0; i < ast_fn->count_vars; ++i) alloc_local(fn);
+    com->first_temp = ast_fn->count_vars;
+    com->free_temps.count = 0;
+    return lower_statement(com, fn, &ast_fn->ast, ast_fn->body);
+}
 
-    if(!lexer_get_token(lex)) return false;
-    if(lex->token == TOKEN_COLON) {
-        if(!lexer_get_and_expect_token(lex, TOKEN_ID)) return false;
-        while(lex->token == TOKEN_ID) {
-            if(find_var(com, lex->string) != NULL) {
-                compiler_diagf(lex->loc, "Variable with name `%s` is already exists", lex->string);
-                return false;
+// PARALLEL
+//
+// Top-level functions share nothing but the static data, so with -j they
+// are parsed and lowered on worker threads, each with a Compiler of its
+// own, then merged in source order with their string literals appended to
+// the static data in that same order. Where functions start is only
+// guessed by matching braces over the token stream and the workers do not
+// report errors: from the first function that fails or does not end where
+// the next guess starts, compilation goes on in the calling thread as if
+// there was no -j. Code generation is split the same way.
+
+typedef struct {
+    size_t first_token; // its `function`, index into the token stream
+    size_t last_token;  // its closing brace
+    bool ok;
+    Function fn;
+    // Its string literals within the static data of its worker
+    size_t static_begin;
+    size_t static_end;
+} FunctionJob;
+
+typedef struct {
+    FunctionJob *items;
+    size_t count;
+    size_t capacity;
+} FunctionJobs;
+
+typedef struct {
+    Thread thread;
+    Compiler com;
+    Lexer lex;
+    FunctionJob *jobs;
+    size_t count_jobs;
+} CompileWorker;
+
+typedef struct {
+    Thread thread;
+    Program *program;
+    Function *funcs;
+    size_t count_funcs;
+    Nob_String_Builder output;
+    bool ok;
+} CodegenWorker;
+
+// Where the functions from the position of lex on probably are, up to the
+// first thing that does not look like one
+static void skim_functions(const Lexer *lex, FunctionJobs *jobs)
+{
+    const TokenStream *stream = lex->stream;
+    size_t i = lex->parse_point.token_index;
+    while(i < stream->count && stream->kinds[i] == TOKEN_FUNCTION) {
+        size_t depth = 0;
+        size_t j = i;
+        for(; j < stream->count; ++j) {
+            Token kind = stream->kinds[j];
+            if(kind == TOKEN_EOF || kind == TOKEN_PARSING_ERROR) return;
+            if(kind == TOKEN_OCURLY) depth += 1;
+            else if(kind == TOKEN_CCURLY && depth > 0 && --depth == 0) break;
+        }
+        if(j == stream->count) return;
+        nob_da_append(jobs, ((FunctionJob) { .first_token = i, .last_token = j }));
+        i = j + 1;
+    }
+}
+
+static void compile_worker_run(void *data)
+{
+    CompileWorker *worker = data;
+    Compiler *com = &worker->com;
+    Lexer *lex = &worker->lex;
+    compiler_mute_diags(true);
+    for(size_t i = 0; i < worker->count_jobs; ++i) {
+        FunctionJob *job = &worker->jobs[i];
+        AstFunction ast_fn = {0};
+        lex->parse_point.token_index = job->first_token;
+        lex->lookahead_count = 0;
+        job->static_begin = com->static_data.count;
+        scope_push(com);
+        job->ok = lexer_advance(lex) && parse_function(com, &ast_fn, lex);
+        scope_pop(com);
+        com->pending_nodes.count = 0;
+        job->ok = job->ok && lex->token_offset == lex->stream->offsets[job->last_token];
+        job->ok = job->ok && lower_function(com, &job->fn, &ast_fn);
+        ast_free(&ast_fn.ast);
+        job->static_end = com->static_data.count;
+        // Everything from here on is compiled again anyway
+        if(!job->ok) break;
+    }
+    compiler_mute_diags(false);
+}
+
+static void rebase_static_data(Function *fn, size_t delta)
+{
+    fn->static_begin += delta;
+    fn->static_end += delta;
+    for(size_t i = 0; i < fn->count; ++i) {
+        for(size_t j = 0; j < NOB_ARRAY_LEN(fn->items[i].args); ++j) {
+            Arg *arg = &fn->items[i].args[j];
+            if(arg->kind == ARG_STATIC_DATA) arg->static_offset += delta;
+            if(arg->kind != ARG_LIST) continue;
+            for(size_t k = 0; k < arg->list.count; ++k) {
+                if(arg->list.items[k].kind == ARG_STATIC_DATA) arg->list.items[k].static_offset += delta;
             }
-            alloc_var_local(com, arena_strdup(&com->arena, lex->string), alloc_local(fn));
-            lexer_get_token(lex);
-            if(lex->token == TOKEN_COMMA) lexer_get_token(lex);
         }
     }
+}
 
-    if(!lexer_expect_token(lex, TOKEN_OCURLY)) return false;
-    if(!compile_block(com, fn, lex)) return false;
-    if(!lexer_expect_token(lex, TOKEN_CCURLY)) return false;
-    return true;
+// Compiles as many of the functions ahead of lex as it can on up to
+// `threads` threads into com and leaves lex right after them. The workers
+// hold on to memory the functions point into until compile_workers_free().
+static void compile_functions_parallel(Compiler *com, Lexer *lex, size_t threads, CompileWorker **workers, size_t *count_workers)
+{
+    assert(lex->lookahead_count == 0);
+    FunctionJobs jobs = {0};
+    skim_functions(lex, &jobs);
+    size_t count = jobs.count < threads ? jobs.count : threads;
+    *workers = NULL;
+    *count_workers = 0;
+    if(count <= 1) {
+        nob_da_free(jobs);
+        return;
+    }
+
+    // Contiguous runs of functions, about the same number of tokens each
+    *workers = calloc(count, sizeof(**workers));
+    assert(*workers != NULL && "Buy more RAM LOL!");
+    *count_workers = count;
+    size_t total_tokens = jobs.items[jobs.count - 1].last_token + 1 - jobs.items[0].first_token;
+    size_t done_tokens = 0;
+    for(size_t i = 0, w = 0; i < jobs.count; ++i) {
+        CompileWorker *worker = &(*workers)[w];
+        if(worker->count_jobs == 0) worker->jobs = &jobs.items[i];
+        worker->count_jobs += 1;
+        done_tokens += jobs.items[i].last_token + 1 - jobs.items[i].first_token;
+        if(w + 1 < count && done_tokens * count >= total_tokens * (w + 1)) w += 1;
+    }
+    for(size_t w = 0; w < count; ++w) {
+        CompileWorker *worker = &(*workers)[w];
+        worker->com.target = com->target;
+        worker->lex = *lex;
+        worker->lex.arena = (Arena){0};
+        worker->lex.served_tokens = 0;
+        if(worker->count_jobs > 0) thread_start(&worker->thread, compile_worker_run, worker);
+    }
+    for(size_t w = 0; w < count; ++w) {
+        if((*workers)[w].count_jobs > 0) thread_join(&(*workers)[w].thread);
+    }
+
+    size_t resume = lex->parse_point.token_index;
+    bool merging = true;
+    for(size_t w = 0; w < count; ++w) {
+        CompileWorker *worker = &(*workers)[w];
+        lex->served_tokens += worker->lex.served_tokens;
+        for(size_t i = 0; i < worker->count_jobs; ++i) {
+            FunctionJob *job = &worker->jobs[i];
+            merging = merging && job->ok;
+            if(!merging) {
+                nob_da_free(job->fn);
+                continue;
+            }
+            size_t base = com->static_data.count;
+            nob_sb_append_buf(&com->static_data, worker->com.static_data.items + job->static_begin, job->static_end - job->static_begin);
+            rebase_static_data(&job->fn, base - job->static_begin);
+            nob_da_append(&com->funcs, job->fn);
+            resume = job->last_token + 1;
+        }
+    }
+    lex->parse_point.token_index = resume;
+    nob_da_free(jobs);
+}
+
+static void compile_workers_free(CompileWorker *workers, size_t count_workers)
+{
+    for(size_t w = 0; w < count_workers; ++w) {
+        Compiler *com = &workers[w].com;
+        arena_free(&com->arena);
+        arena_free(&workers[w].lex.arena);
+        nob_da_free(com->static_data);
+        nob_da_free(com->vars);
+        free(com->var_slots.items);
+        nob_da_free(com->scopes);
+        nob_da_free(com->pending_nodes);
+        nob_da_free(com->free_temps);
+    }
+    free(workers);
+}
+
+static void codegen_worker_run(void *data)
+{
+    CodegenWorker *worker = data;
+    compiler_mute_diags(true);
+    worker->ok = true;
+    for(size_t i = 0; i < worker->count_funcs && worker->ok; ++i) {
+        worker->ok = generate_function(worker->program, &worker->funcs[i], &worker->output);
+    }
+    compiler_mute_diags(false);
+}
+
+// Same as generate_program(), with the functions generated on up to
+// `threads` threads
+static bool generate_program_parallel(Program *program, Nob_String_Builder *output, size_t threads)
+{
+    size_t count = program->count_funcs < threads ? program->count_funcs : threads;
+    // The IR target dumps straight to stdout
+    if(count <= 1 || program->target == TARGET_IR) return generate_program(program, output);
+
+    size_t total_insts = 0;
+    for(size_t i = 0; i < program->count_funcs; ++i) total_insts += program->funcs[i].count;
+    CodegenWorker *workers = calloc(count, sizeof(*workers));
+    assert(workers != NULL && "Buy more RAM LOL!");
+    size_t done_insts = 0;
+    for(size_t i = 0, w = 0; i < program->count_funcs; ++i) {
+        CodegenWorker *worker = &workers[w];
+        if(worker->count_funcs == 0) worker->funcs = &program->funcs[i];
+        worker->count_funcs += 1;
+        done_insts += program->funcs[i].count;
+        if(w + 1 < count && done_insts * count >= total_insts * (w + 1)) w += 1;
+    }
+    for(size_t w = 0; w < count; ++w) {
+        workers[w].program = program;
+        workers[w].ok = true;
+        if(workers[w].count_funcs > 0) thread_start(&workers[w].thread, codegen_worker_run, &workers[w]);
+    }
+    for(size_t w = 0; w < count; ++w) {
+        if(workers[w].count_funcs > 0) thread_join(&workers[w].thread);
+    }
+
+    bool ok = true;
+    for(size_t w = 0; w < count; ++w) ok = ok && workers[w].ok;
+    if(ok) {
+        generate_program_prolog(program, output);
+        for(size_t w = 0; w < count; ++w) nob_sb_append_buf(output, workers[w].output.items, workers[w].output.count);
+        generate_program_epilog(program, output);
+    } else {
+        // Once more to report what went wrong
+        ok = generate_program(program, output);
+    }
+    for(size_t w = 0; w < count; ++w) nob_da_free(workers[w].output);
+    free(workers);
+    return ok;
 }
 
-bool compile_program(Compiler *com, Nob_String_Builder *output, Lexer *lex)
+bool compile_program(Compiler *com, Nob_String_Builder *output, Lexer *lex, size_t threads)
 {
     bool ok = true;
-    while(lexer_get_token(lex) && lex->token != TOKEN_EOF) {
+    CompileWorker *workers = NULL;
+    size_t count_workers = 0;
+    if(threads > 1 && lex->stream != NULL) compile_functions_parallel(com, lex, threads, &workers, &count_workers);
+
+    while(lexer_advance(lex) && lex->token != TOKEN_EOF) {
+        AstFunction ast_fn = {0};
         Function fn = {0};
-        ok = compile_function(com, &fn, lex, output);
-        if(!ok) break;
+        // The variables live in the function's scope, its body opens another
+        scope_push(com);
+        ok = parse_function(com, &ast_fn, lex);
+        scope_pop(com);
+        com->pending_nodes.count = 0;
+        ok = ok && lower_function(com, &fn, &ast_fn);
+        ast_free(&ast_fn.ast);
+        if(!ok) {
+            nob_da_free(fn);
+            break;
+        }
         nob_da_append(&com->funcs, fn);
     }
-    if(!lexer_get_and_expect_token(lex, TOKEN_EOF)) return false;
+
+    if(!lexer_get_and_expect_token(lex, TOKEN_EOF)) ok = false;
 
     if(ok) {
-        ok = ok && lexer_get_and_expect_token(lex, TOKEN_EOF);
         Program program = {0};
         program.target = com->target;
         program.funcs = com->funcs.items;
         program.count_funcs = com->funcs.count;
         program.static_data = com->static_data.items;
         program.count_static_data = com->static_data.count;
-        ok = ok && generate_program(&program, output);
+        ok = ok && generate_program_parallel(&program, output, threads);
     }
 
     for(size_t i = 0; i < com->funcs.count; ++i) {
@@ -466,10 +1342,496 @@ bool compile_program(Compiler *com, Nob_String_Builder *output, Lexer *lex)
 
     nob_da_free(com->funcs);
     arena_free(&com->arena);
+    compile_workers_free(workers, count_workers);
     return ok;
 }
 
 
+// PIPELINE
+//
+// Lexing, parsing with lowering, and code generation on three threads
+// at once. Tokens and then functions go over bounded queues, so a stage
+// that runs ahead waits for the next one. There is a single code
+// generator and it takes the functions in order, the output is the same
+// as compile_program() gives.
+
+#define PIPELINE_TOKENS 4096
+#define PIPELINE_FUNCS 64
+
+typedef struct {
+    Program *program;
+    SpscQueue funcs;
+    Nob_String_Builder *output;
+    // Kept to report it once the pipeline is down
+    Function failed;
+    bool ok;
+    Thread thread;
+} PipelineCodegen;
+
+static void pipeline_codegen_run(void *data)
+{
+    PipelineCodegen *codegen = data;
+    compiler_mute_diags(true);
+    Function fn;
+    while(spsc_pop(&codegen->funcs, &fn)) {
+        // Past a failure the functions are only freed
+        if(codegen->ok && !generate_function(codegen->program, &fn, codegen->output)) {
+            codegen->ok = false;
+            codegen->failed = fn;
+            continue;
+        }
+        nob_da_free(fn);
+    }
+    compiler_mute_diags(false);
+}
+
+// Same as compile_program(), pipelined
+bool compile_program_pipelined(Compiler *com, Nob_String_Builder *output, Lexer *lex)
+{
+    // The IR target dumps straight to stdout, that stays in order with the
+    // diagnostics only when nothing runs ahead
+    if(com->target == TARGET_IR || lex->stream != NULL) return compile_program(com, output, lex, 1);
+
+    Program program = {0};
+    program.target = com->target;
+    generate_program_prolog(&program, output);
+
+    LexerFeed *feed = lexer_feed_start(lex, PIPELINE_TOKENS);
+    PipelineCodegen codegen = {0};
+    codegen.program = &program;
+    codegen.output = output;
+    codegen.ok = true;
+    spsc_init(&codegen.funcs, sizeof(Function), PIPELINE_FUNCS);
+    thread_start(&codegen.thread, pipeline_codegen_run, &codegen);
+
+    bool ok = true;
+    while(lexer_advance(lex) && lex->token != TOKEN_EOF) {
+        AstFunction ast_fn = {0};
+        Function fn = {0};
+        scope_push(com);
+        ok = parse_function(com, &ast_fn, lex);
+        scope_pop(com);
+        com->pending_nodes.count = 0;
+        ok = ok && lower_function(com, &fn, &ast_fn);
+        ast_free(&ast_fn.ast);
+        if(!ok) {
+            nob_da_free(fn);
+            break;
+        }
+        spsc_push(&codegen.funcs, &fn);
+    }
+    // Scanning on demand goes on past an error, a stream replays it
+    if(lex->token == TOKEN_PARSING_ERROR) ok = false;
+    if(!lexer_get_and_expect_token(lex, TOKEN_EOF)) ok = false;
+
+    spsc_close(&codegen.funcs);
+    thread_join(&codegen.thread);
+    lexer_feed_stop(lex, feed);
+
+    if(!ok) {
+        // compile_program() generates nothing when parsing fails
+        output->count = 0;
+    } else if(!codegen.ok) {
+        // Once more to report what went wrong
+        Nob_String_Builder scratch = {0};
+        generate_function(&program, &codegen.failed, &scratch);
+        nob_da_free(scratch);
+        ok = false;
+    } else {
+        program.static_data = com->static_data.items;
+        program.count_static_data = com->static_data.count;
+        generate_program_epilog(&program, output);
+    }
+
+    nob_da_free(codegen.failed);
+    spsc_free(&codegen.funcs);
+    arena_free(&com->arena);
+    return ok;
+}
+
+// COMPILE CACHE
+//
+// A function compiles to the same code whenever its tokens are the same.
+// Its string literals are kept with it and appended to the static data
+// wherever that ends when it is taken from cache, which its code does not
+// depend on, see generate_function_strings(). Only the functions
+// skim_functions() finds ahead are looked up, anything past them is
+// compiled as usual. The key holds CODEGEN_VERSION, a blnc that generates
+// other code misses the entries of an older one.
+
+static void function_cache_key(const Compiler *com, const Lexer *lex, const FunctionJob *job, Nob_String_Builder *key)
+{
+    const TokenStream *stream = lex->stream;
+    key->count = 0;
+    nob_sb_appendf(key, "blnc codegen %d\n%s\n", CODEGEN_VERSION, display_target(com->target));
+    for(size_t i = job->first_token; i <= job->last_token; ++i) {
+        nob_sb_appendf(key, "%u %u ", (unsigned)stream->kinds[i], (unsigned)stream->lengths[i]);
+        nob_sb_append_buf(key, lex->input_stream + stream->offsets[i], stream->lengths[i]);
+    }
+}
+
+// Same as compile_program(), with the code of every function taken from
+// cache when it is there and stored into it otherwise
+bool compile_program_cached(Compiler *com, Nob_String_Builder *output, Lexer *lex, Cache *cache)
+{
+    // The IR target dumps straight to stdout, there is nothing to keep
+    if(com->target == TARGET_IR || lex->stream == NULL) return compile_program(com, output, lex, 1);
+
+    FunctionJobs jobs = {0};
+    skim_functions(lex, &jobs);
+    Program program = {0};
+    program.target = com->target;
+    generate_program_prolog(&program, output);
+
+    Nob_String_Builder key = {0};
+    Nob_String_Builder code = {0};
+    size_t next_job = 0;
+    bool ok = true;
+    while(true) {
+        FunctionJob *job = NULL;
+        if(next_job < jobs.count && lex->lookahead_count == 0 && lex->parse_point.token_index == jobs.items[next_job].first_token) {
+            job = &jobs.items[next_job++];
+            function_cache_key(com, lex, job, &key);
+            code.count = 0;
+            size_t static_begin = com->static_data.count;
+            if(cache_load(cache, key.items, key.count, &com->static_data, &code)) {
+                if(com->static_data.count > static_begin) {
+                    // Stored only once it compiled, so its name follows the `function`
+                    const TokenStream *stream = lex->stream;
+                    uint32_t name = intern(lex->input_stream + stream->offsets[job->first_token + 1], stream->lengths[job->first_token + 1]);
+                    generate_function_strings(&program, name, static_begin, output);
+                }
+                nob_sb_append_buf(output, code.items, code.count);
+                lex->parse_point.token_index = job->last_token + 1;
+                continue;
+            }
+        }
+
+        if(!lexer_advance(lex) || lex->token == TOKEN_EOF) break;
+        AstFunction ast_fn = {0};
+        Function fn = {0};
+        size_t static_begin = com->static_data.count;
+        scope_push(com);
+        ok = parse_function(com, &ast_fn, lex);
+        scope_pop(com);
+        com->pending_nodes.count = 0;
+        ok = ok && lower_function(com, &fn, &ast_fn);
+        ast_free(&ast_fn.ast);
+        code.count = 0;
+        if(ok && fn.static_end > fn.static_begin) generate_function_strings(&program, fn.name, fn.static_begin, output);
+        ok = ok && generate_function_code(&program, &fn, &code);
+        nob_da_free(fn);
+        arena_reset(&com->arena);
+        if(!ok) break;
+
+        if(job != NULL && lex->token_offset == lex->stream->offsets[job->last_token]) {
+            cache_store(cache, key.items, key.count,
+                        com->static_data.items + static_begin, com->static_data.count - static_begin,
+                        code.items, code.count);
+        } else {
+            // The skimmed functions are off from here on
+            next_job = jobs.count;
+        }
+        nob_sb_append_buf(output, code.items, code.count);
+    }
+    if(lex->token == TOKEN_PARSING_ERROR) ok = false;
+    if(!lexer_get_and_expect_token(lex, TOKEN_EOF)) ok = false;
+
+    if(ok) {
+        program.static_data = com->static_data.items;
+        program.count_static_data = com->static_data.count;
+        generate_program_epilog(&program, output);
+    } else {
+        output->count = 0;
+    }
+
+    nob_da_free(jobs);
+    nob_da_free(key);
+    nob_da_free(code);
+    arena_free(&com->arena);
+    return ok;
+}
+
+// STREAMING
+
+static bool write_output(FILE *output, Nob_String_Builder *sb)
+{
+    if(sb->count == 0) return true;
+    bool ok = fwrite(sb->items, 1, sb->count, output) == sb->count;
+    if(!ok) nob_log(NOB_ERROR, "Could not write the output: %s", strerror(errno));
+    sb->count = 0;
+    return ok;
+}
+
+// Same output as compile_program(), except every function goes to output
+// as soon as it is compiled and its memory is reused for the next one, so
+// only the static data and the interned names grow with the input. Reads
+// the tokens straight from the source and hands the pages of input already
+// compiled back to the OS.
+bool compile_program_streaming(Compiler *com, FILE *output, Lexer *lex, SourceFile *input)
+{
+    assert(lex->stream == NULL && "Streaming does not need the tokens up front");
+    bool ok = true;
+    Program program = {0};
+    program.target = com->target;
+    Nob_String_Builder sb = {0};
+    generate_program_prolog(&program, &sb);
+    ok = write_output(output, &sb);
+
+    Arena_Mark lex_mark = {0};
+    bool lex_marked = false;
+    while(ok && lexer_advance(lex) && lex->token != TOKEN_EOF) {
+        // After the first token, the lexer keeps its tables in the arena
+        if(!lex_marked) {
+            lex_mark = arena_snapshot(&lex->arena);
+            lex_marked = true;
+        }
+        AstFunction ast_fn = {0};
+        Function fn = {0};
+        scope_push(com);
+        ok = parse_function(com, &ast_fn, lex);
+        scope_pop(com);
+        com->pending_nodes.count = 0;
+        ok = ok && lower_function(com, &fn, &ast_fn);
+        ast_free(&ast_fn.ast);
+        ok = ok && generate_function(&program, &fn, &sb);
+        ok = ok && write_output(output, &sb);
+        nob_da_free(fn);
+        arena_reset(&com->arena);
+        // Decoded strings of the function were copied to the static data
+        if(lex->lookahead_count == 0) arena_rewind(&lex->arena, lex_mark);
+        source_file_release(input, lex->input_stream + lex->token_offset);
+    }
+
+    // Scanning on demand goes on past an error, a stream replays it
+    if(lex->token == TOKEN_PARSING_ERROR) ok = false;
+    if(!lexer_get_and_expect_token(lex, TOKEN_EOF)) ok = false;
+
+    if(ok) {
+        program.static_data = com->static_data.items;
+        program.count_static_data = com->static_data.count;
+        generate_program_epilog(&program, &sb);
+        ok = write_output(output, &sb);
+    }
+
+    nob_da_free(sb);
+    arena_free(&com->arena);
+    return ok;
+}
+
+
+// RELEX CHECK
+//
+// lexer_relex() has to leave the same tokens as lexing the edited input
+// from scratch. -relex-check makes edits spread over the input, one at a
+// time, and compares both instead of compiling.
+
+static const char *relex_check_inserts[] = {
+    " ", "\n", "x", "9", ".5e", "0x", "\"", "'", "\\", "/*", "*/", "//", "=", "<",
+};
+
+static bool check_same_token(const TokenStream *a, size_t i, const TokenStream *b, size_t j)
+{
+    if(a->kinds[i] != b->kinds[j] || a->offsets[i] != b->offsets[j] || a->lengths[i] != b->lengths[j]) return false;
+    // Payloads index side arrays filled in a different order, compare what they point at
+    uint32_t pa = a->payloads[i];
+    uint32_t pb = b->payloads[j];
+    switch(a->kinds[i]) {
+        case TOKEN_STRING_LIT:
+            return a->strings.items[pa].length == b->strings.items[pb].length
+                && memcmp(a->strings.items[pa].data, b->strings.items[pb].data, a->strings.items[pa].length) == 0;
+        case TOKEN_INT_LIT:
+        case TOKEN_CHAR_LIT:
+            return a->ints.items[pa] == b->ints.items[pb];
+        case TOKEN_FLOAT_LIT:
+            return memcmp(&a->reals.items[pa], &b->reals.items[pb], sizeof(double)) == 0;
+        default:
+            return pa == pb;
+    }
+}
+
+typedef struct {
+    char *input_path;
+    const char *input;
+    size_t size;
+    size_t threads;
+    // Both are reset for every edit, their sources stay registered
+    Lexer relex;
+    Lexer lex;
+    // The edited input, room for the longest insert
+    char *edited;
+} RelexCheck;
+
+// Replaces input[edit.begin, edit.end) with replacement, relexes and lexes
+// from scratch
+static bool relex_check_edit(RelexCheck *check, TextEdit edit, const char *replacement)
+{
+    size_t edited_size = check->size - (edit.end - edit.begin) + edit.length;
+    memcpy(check->edited, check->input, edit.begin);
+    memcpy(check->edited + edit.begin, replacement, edit.length);
+    memcpy(check->edited + edit.begin + edit.length, check->input + edit.end, check->size - edit.end);
+    check->edited[edited_size] = '\0';
+
+    TokenStream relexed = {0};
+    lexer_reset(&check->relex, (char*)check->input, (char*)check->input + check->size);
+    lexer_tokenize_parallel(&check->relex, &relexed, check->threads);
+    bool relex_ok = lexer_relex(&check->relex, &relexed, check->edited, check->edited + edited_size, edit);
+    TokenStream tokens = {0};
+    lexer_reset(&check->lex, check->edited, check->edited + edited_size);
+    bool ok = lexer_tokenize_parallel(&check->lex, &tokens, check->threads);
+
+    size_t i = 0;
+    while(i < relexed.count && i < tokens.count && check_same_token(&relexed, i, &tokens, i)) i += 1;
+    bool same = relex_ok == ok && i == relexed.count && i == tokens.count;
+    if(!same) {
+        nob_log(NOB_ERROR, "%s: replacing [%zu, %zu) with \"%.*s\" relexes %zu tokens, lexing from scratch gives %zu",
+                check->input_path, edit.begin, edit.end, (int)edit.length, replacement, relexed.count, tokens.count);
+        if(i < relexed.count && i < tokens.count) {
+            nob_log(NOB_ERROR, "    token %zu: relexed %s at %u+%u, from scratch %s at %u+%u", i,
+                    lexer_display_token(relexed.kinds[i]), relexed.offsets[i], relexed.lengths[i],
+                    lexer_display_token(tokens.kinds[i]), tokens.offsets[i], tokens.lengths[i]);
+        }
+    }
+
+    token_stream_free(&relexed);
+    token_stream_free(&tokens);
+    return same;
+}
+
+// Edits around `places` tokens of the input: every one of
+// relex_check_inserts at the start and in the middle of the token, and
+// removing its first byte or all of it
+static bool relex_check(char *input_path, const char *input, size_t size, size_t places, size_t threads)
+{
+    RelexCheck check = {
+        .input_path = input_path,
+        .input = input,
+        .size = size,
+        .threads = threads,
+        .relex = lexer_new(input_path, (char*)input, (char*)input + size),
+        .lex = lexer_new(input_path, (char*)input, (char*)input + size),
+    };
+    size_t longest = 0;
+    for(size_t r = 0; r < NOB_ARRAY_LEN(relex_check_inserts); ++r) {
+        if(strlen(relex_check_inserts[r]) > longest) longest = strlen(relex_check_inserts[r]);
+    }
+    check.edited = malloc(size + longest + 1);
+    assert(check.edited != NULL && "Buy more RAM LOL!");
+
+    TokenStream tokens = {0};
+    lexer_tokenize_parallel(&check.lex, &tokens, threads);
+    if(places > tokens.count) places = tokens.count;
+
+    // Lexing errors of the edits are expected
+    compiler_mute_diags(true);
+    size_t edits = 0;
+    size_t failed = 0;
+    for(size_t k = 0; k < places; ++k) {
+        size_t t = k * tokens.count / places;
+        size_t at[] = {tokens.offsets[t], tokens.offsets[t] + tokens.lengths[t] / 2};
+        for(size_t a = 0; a < NOB_ARRAY_LEN(at); ++a) {
+            for(size_t r = 0; r < NOB_ARRAY_LEN(relex_check_inserts); ++r) {
+                TextEdit edit = {at[a], at[a], strlen(relex_check_inserts[r])};
+                failed += !relex_check_edit(&check, edit, relex_check_inserts[r]);
+                edits += 1;
+            }
+        }
+        if(tokens.lengths[t] > 0) {
+            TextEdit first_byte = {tokens.offsets[t], tokens.offsets[t] + 1, 0};
+            TextEdit whole = {tokens.offsets[t], tokens.offsets[t] + tokens.lengths[t], 0};
+            failed += !relex_check_edit(&check, first_byte, "");
+            failed += !relex_check_edit(&check, whole, "");
+            edits += 2;
+        }
+    }
+    compiler_mute_diags(false);
+
+    fprintf(stderr, "Relex check: %zu edits, %zu mismatches\n", edits, failed);
+    token_stream_free(&tokens);
+    lexer_destroy(&check.relex);
+    lexer_destroy(&check.lex);
+    free(check.edited);
+    return failed == 0;
+}
+
+// REGISTER CHECK
+//
+// The built-in tokens registered through lexer_register_punct() and
+// lexer_register_keyword() have to lex like the built-in set, and a keyword
+// registered on top of them has to take exactly the identifiers spelled
+// like it. -register-check lexes the input those ways instead of compiling.
+
+// Compares tokens against builtin, where an identifier with id keyword_id
+// is expected to be the keyword token instead, TOKEN_ID for none
+static bool register_check_compare(char *input_path, const char *what, Lexer *lex, const TokenStream *builtin, const TokenStream *tokens, Token keyword, uint32_t keyword_id)
+{
+    size_t i = 0;
+    for(; i < builtin->count && i < tokens->count; ++i) {
+        bool renamed = keyword != TOKEN_ID && builtin->kinds[i] == TOKEN_ID && builtin->payloads[i] == keyword_id;
+        bool same = renamed
+            ? tokens->kinds[i] == keyword && tokens->offsets[i] == builtin->offsets[i] && tokens->lengths[i] == builtin->lengths[i]
+            : check_same_token(builtin, i, tokens, i);
+        if(!same) break;
+    }
+    if(i == builtin->count && i == tokens->count) return true;
+    nob_log(NOB_ERROR, "%s: %s lexes %zu tokens, the built-in set %zu", input_path, what, tokens->count, builtin->count);
+    if(i < builtin->count && i < tokens->count) {
+        nob_log(NOB_ERROR, "    token %zu: registered %s at %u+%u, built-in %s at %u+%u", i,
+                lexer_display_token_of(lex, tokens->kinds[i]), tokens->offsets[i], tokens->lengths[i],
+                lexer_display_token(builtin->kinds[i]), builtin->offsets[i], builtin->lengths[i]);
+    }
+    return false;
+}
+
+static bool register_check(char *input_path, char *input, size_t size, size_t threads)
+{
+    // Any lexing error is the same for every set
+    compiler_mute_diags(true);
+    Lexer builtin = lexer_new(input_path, input, input + size);
+    TokenStream builtin_tokens = {0};
+    lexer_tokenize_parallel(&builtin, &builtin_tokens, threads);
+
+    Lexer registered = lexer_new(input_path, input, input + size);
+    lexer_register_builtin_tokens(&registered);
+    TokenStream registered_tokens = {0};
+    lexer_tokenize_parallel(&registered, &registered_tokens, threads);
+    bool ok = register_check_compare(input_path, "registering the built-in tokens", &registered,
+                                     &builtin_tokens, &registered_tokens, TOKEN_ID, 0);
+
+    // A new keyword spelled like the first identifier of the input. A
+    // literal that is registered already is refused.
+    size_t first_id = 0;
+    while(first_id < builtin_tokens.count && builtin_tokens.kinds[first_id] != TOKEN_ID) first_id += 1;
+    if(first_id < builtin_tokens.count) {
+        const char *literal = nob_temp_sprintf("%.*s", (int)builtin_tokens.lengths[first_id], input + builtin_tokens.offsets[first_id]);
+        Lexer keyword = lexer_new(input_path, input, input + size);
+        lexer_register_builtin_tokens(&keyword);
+        bool accepted = lexer_register_keyword(&keyword, _COUNT_TOKENS, literal);
+        bool refused = !lexer_register_keyword(&keyword, _COUNT_TOKENS + 1, literal)
+                    && !lexer_register_punct(&keyword, _COUNT_TOKENS + 1, "+");
+        if(!accepted || !refused) {
+            nob_log(NOB_ERROR, "%s: registering keyword `%s` %s", input_path, literal,
+                    accepted ? "again or `+` again is not refused" : "is refused");
+            ok = false;
+        }
+        TokenStream keyword_tokens = {0};
+        lexer_tokenize_parallel(&keyword, &keyword_tokens, threads);
+        ok = register_check_compare(input_path, nob_temp_sprintf("registering keyword `%s`", literal), &keyword,
+                                    &builtin_tokens, &keyword_tokens, _COUNT_TOKENS, builtin_tokens.payloads[first_id]) && ok;
+        token_stream_free(&keyword_tokens);
+        lexer_destroy(&keyword);
+    }
+    compiler_mute_diags(false);
+
+    fprintf(stderr, "Register check: %s\n", ok ? "same tokens" : "mismatches");
+    token_stream_free(&builtin_tokens);
+    token_stream_free(&registered_tokens);
+    lexer_destroy(&builtin);
+    lexer_destroy(&registered);
+    nob_temp_reset();
+    return ok;
+}
+
 void usage(FILE *stream)
 {
     fprintf(stream, "Usage: ./blnc [OPTIONS] [--] <OUTPUT FILES...>\n");
@@ -497,36 +1859,77 @@ Target parse_target(const char *target_str)
     exit(-1);
 }
 
-int main(int argc, char **argv)
-{
-    bool *help = flag_bool("help", false, "Print this help to stdout");
-    char **target_str = flag_str("t", NULL, "Target platform to compilation");
+typedef struct {
+    bool *help;
+    char **target_str;
+    bool *stats;
+    size_t *lex_threads;
+    size_t *jobs;
+    char **cache_dir;
+    bool *pipeline;
+    bool *stream;
+    char **server;
+    size_t *relex_check;
+    bool *register_check;
+} Options;
 
+// One blnc command, from the command line or from a client of the server.
+// Those come without the program name, flag_parse() only takes it the
+// first time, and start from the flags the server was given.
+static int run_command(void *data, int argc, char **argv, ServerRequest *request)
+{
+    Options *opt = data;
     if(!flag_parse(argc, argv)) {
         usage(stderr);
         flag_print_error(stderr);
         return -1;
     }
 
-    if(*help) {
+    if(*opt->help) {
         usage(stdout);
         return 0; 
     }
 
+    if(*opt->server != NULL && request == NULL) {
+        // Every request is forked off with the tables already built
+        lexer_build_tables();
+        return server_serve(*opt->server, run_command, opt) ? 0 : -1;
+    }
+
     int rest_argc = flag_rest_argc();
     char **rest_argv = flag_rest_argv();
-    Target target = parse_target(*target_str);
+    Target target = parse_target(*opt->target_str);
 
     char *input = nob_shift(rest_argv, rest_argc);
 
-    Nob_String_Builder input_data = {0};
-    if(!nob_read_entire_file(input, &input_data)) {
+    SourceFile input_file = {0};
+    if(request != NULL ? !server_open_input(request, input, &input_file) : !source_file_open(input, &input_file)) {
         fprintf(stderr, "error: invalid input file %s\n", input);
+        return -1;
+    }
+
+    if(*opt->relex_check > 0) {
+        bool ok = relex_check(input, input_file.data, input_file.size, *opt->relex_check,
+                              *opt->lex_threads == 0 ? thread_count_processors() : *opt->lex_threads);
+        intern_free();
+        source_file_close(&input_file);
+        return ok ? 0 : -1;
+    }
+
+    if(*opt->register_check) {
+        bool ok = register_check(input, input_file.data, input_file.size,
+                                 *opt->lex_threads == 0 ? thread_count_processors() : *opt->lex_threads);
+        intern_free();
+        source_file_close(&input_file);
+        return ok ? 0 : -1;
     }
 
     Compiler com = {0};
     Nob_String_Builder output = {0};
-    Lexer lex = lexer_new(input, input_data.items, input_data.items + input_data.count);
+    Lexer lex = lexer_new(input, input_file.data, input_file.data + input_file.size);
+    TokenStream tokens = {0};
+    // Streaming and pipelining lex as they go
+    if(!*opt->stream && !*opt->pipeline) lexer_tokenize_parallel(&lex, &tokens, *opt->lex_threads == 0 ? thread_count_processors() : *opt->lex_threads);
 
     com.target = target;
     const char *output_filepath = "a.s";
@@ -534,13 +1937,75 @@ int main(int argc, char **argv)
         output_filepath = "a.html";
     }
 
-    if(!compile_program(&com, &output, &lex)) {
+    bool ok;
+    Cache cache = {0};
+    if(*opt->stream) {
+        // The output for a client is read back once it is complete
+        FILE *f = request != NULL ? tmpfile() : fopen(output_filepath, "wb");
+        if(f == NULL) {
+            nob_log(NOB_ERROR, "Could not open file %s for writing: %s", output_filepath, strerror(errno));
+            return -1;
+        }
+        ok = compile_program_streaming(&com, f, &lex, &input_file);
+        if(request != NULL) {
+            char buffer[64*1024];
+            size_t n;
+            rewind(f);
+            while((n = fread(buffer, 1, sizeof(buffer), f)) > 0) nob_sb_append_buf(&output, buffer, n);
+        }
+        if(fclose(f) != 0) {
+            nob_log(NOB_ERROR, "Could not write file %s: %s", output_filepath, strerror(errno));
+            ok = false;
+        }
+    } else if(*opt->pipeline) {
+        ok = compile_program_pipelined(&com, &output, &lex);
+    } else if(*opt->cache_dir != NULL) {
+        ok = cache_open(&cache, *opt->cache_dir) && compile_program_cached(&com, &output, &lex, &cache);
+    } else {
+        ok = compile_program(&com, &output, &lex, *opt->jobs == 0 ? thread_count_processors() : *opt->jobs);
+    }
+    if(!ok) {
         fprintf(stderr, "Compilation failure\n");
     }
-    if(!nob_write_entire_file(output_filepath, output.items, output.count)) return false;
+    if(*opt->stats) {
+        fprintf(stderr, "Lexer: scanned %zu tokens, %zu in stream, %zu served to the parser\n",
+                lex.scanned_tokens, tokens.count, lex.served_tokens);
+        fprintf(stderr, "Interner: %zu distinct names\n", interned_count());
+        if(*opt->cache_dir != NULL) fprintf(stderr, "Cache: %zu hits, %zu misses\n", cache.hits, cache.misses);
+    }
+    if(request != NULL) {
+        server_write_output(request, output_filepath, output.items, output.count);
+    } else if(!*opt->stream && !nob_write_entire_file(output_filepath, output.items, output.count)) {
+        return false;
+    }
     nob_da_free(output);
+    nob_da_free(com.static_data);
     nob_da_free(com.vars);
+    free(com.var_slots.items);
+    nob_da_free(com.scopes);
+    nob_da_free(com.pending_nodes);
+    nob_da_free(com.free_temps);
+    token_stream_free(&tokens);
+    lexer_destroy(&lex);
+    intern_free();
+    source_file_close(&input_file);
 
     return 0;
 }
 
+int main(int argc, char **argv)
+{
+    Options opt = {0};
+    opt.help = flag_bool("help", false, "Print this help to stdout");
+    opt.target_str = flag_str("t", NULL, "Target platform to compilation");
+    opt.stats = flag_bool("stats", false, "Print lexer statistics to stderr");
+    opt.lex_threads = flag_size("lex-threads", 1, "Threads to lex large inputs with, 0 for one per processor");
+    opt.jobs = flag_size("j", 1, "Threads to compile functions on, 0 for one per processor");
+    opt.cache_dir = flag_str("cache", NULL, "Directory to keep the code of every function in, builds sharing it only compile the functions that changed");
+    opt.pipeline = flag_bool("pipeline", false, "Lex, parse and generate code on three threads at once");
+    opt.stream = flag_bool("stream", false, "Write out every function as soon as it is compiled, memory use does not grow with the input");
+    opt.server = flag_str("server", NULL, "Serve the commands of blnc-client on this Unix socket, the other flags are the defaults of every command");
+    opt.relex_check = flag_size("relex-check", 0, "Instead of compiling, check lexer_relex() against lexing from scratch for edits around this many tokens of the input");
+    opt.register_check = flag_bool("register-check", false, "Instead of compiling, check that the tokens registered through lexer_register_punct() and lexer_register_keyword() lex like the built-in ones");
+    return run_command(&opt, argc, argv, NULL);
+}
@@ -0,0 +1,159 @@
+#include "cache.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#    include <direct.h>
+#else
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+// Bump whenever the layout of an entry changes
+#define CACHE_FORMAT_VERSION "1"
+#define CACHE_MAGIC "blnc-cache " CACHE_FORMAT_VERSION "\n"
+
+#ifdef _WIN32
+static bool cache_mkdir(const char *dir)
+{
+    return _mkdir(dir) == 0 || errno == EEXIST;
+}
+
+static bool cache_replace(const char *from, const char *to)
+{
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+static unsigned long cache_process_id(void)
+{
+    return GetCurrentProcessId();
+}
+#else
+static bool cache_mkdir(const char *dir)
+{
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+static bool cache_replace(const char *from, const char *to)
+{
+    // Atomic on POSIX, readers see the old entry or the new one
+    return rename(from, to) == 0;
+}
+
+static unsigned long cache_process_id(void)
+{
+    return (unsigned long)getpid();
+}
+#endif // _WIN32
+
+static uint64_t cache_hash(const char *data, size_t size)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static void cache_entry_path(Cache *cache, const char *key, size_t key_size, char *path, size_t path_size)
+{
+    snprintf(path, path_size, "%s/%016llx", cache->dir, (unsigned long long)cache_hash(key, key_size));
+}
+
+bool cache_open(Cache *cache, const char *dir)
+{
+    cache->dir = dir;
+    cache->hits = 0;
+    cache->misses = 0;
+    if(!cache_mkdir(dir)) {
+        nob_log(NOB_ERROR, "Could not create cache directory %s: %s", dir, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// Takes the next size prefixed part of an entry, false when it is cut short
+static bool cache_take_part(Nob_String_View *entry, Nob_String_View *part)
+{
+    uint64_t size;
+    if(entry->count < sizeof(size)) return false;
+    memcpy(&size, entry->data, sizeof(size));
+    entry->data += sizeof(size);
+    entry->count -= sizeof(size);
+    if(size > entry->count) return false;
+    *part = nob_sv_from_parts(entry->data, (size_t)size);
+    entry->data += size;
+    entry->count -= size;
+    return true;
+}
+
+bool cache_load(Cache *cache, const char *key, size_t key_size, Nob_String_Builder *static_data, Nob_String_Builder *code)
+{
+    char path[4096];
+    cache_entry_path(cache, key, key_size, path, sizeof(path));
+
+    Nob_String_Builder file = {0};
+    bool hit = false;
+    FILE *f = fopen(path, "rb");
+    if(f != NULL) {
+        char buffer[64*1024];
+        size_t n;
+        while((n = fread(buffer, 1, sizeof(buffer), f)) > 0) nob_sb_append_buf(&file, buffer, n);
+        hit = !ferror(f);
+        fclose(f);
+    }
+
+    Nob_String_View entry = nob_sv_from_parts(file.items, file.count);
+    Nob_String_View stored_key, stored_static_data, stored_code;
+    hit = hit && nob_sv_starts_with(entry, nob_sv_from_cstr(CACHE_MAGIC));
+    if(hit) {
+        entry.data += strlen(CACHE_MAGIC);
+        entry.count -= strlen(CACHE_MAGIC);
+    }
+    hit = hit && cache_take_part(&entry, &stored_key)
+              && cache_take_part(&entry, &stored_static_data)
+              && cache_take_part(&entry, &stored_code)
+              && entry.count == 0;
+    hit = hit && stored_key.count == key_size && memcmp(stored_key.data, key, key_size) == 0;
+    if(hit) {
+        if(stored_static_data.count > 0) nob_sb_append_buf(static_data, stored_static_data.data, stored_static_data.count);
+        nob_sb_append_buf(code, stored_code.data, stored_code.count);
+        cache->hits += 1;
+    } else {
+        cache->misses += 1;
+    }
+    nob_da_free(file);
+    return hit;
+}
+
+static bool cache_write_part(FILE *f, const char *data, size_t size)
+{
+    uint64_t prefix = size;
+    return fwrite(&prefix, sizeof(prefix), 1, f) == 1 && (size == 0 || fwrite(data, 1, size, f) == size);
+}
+
+void cache_store(Cache *cache, const char *key, size_t key_size,
+                 const char *static_data, size_t static_data_size,
+                 const char *code, size_t code_size)
+{
+    static size_t count_stored = 0;
+    char path[4096];
+    char temp_path[4096 + 64];
+    cache_entry_path(cache, key, key_size, path, sizeof(path));
+    // Unique among every compiler sharing the directory
+    snprintf(temp_path, sizeof(temp_path), "%s.%lu.%zu.tmp", path, cache_process_id(), count_stored++);
+
+    FILE *f = fopen(temp_path, "wb");
+    if(f == NULL) return;
+    bool ok = fwrite(CACHE_MAGIC, 1, strlen(CACHE_MAGIC), f) == strlen(CACHE_MAGIC)
+           && cache_write_part(f, key, key_size)
+           && cache_write_part(f, static_data, static_data_size)
+           && cache_write_part(f, code, code_size);
+    ok = fclose(f) == 0 && ok;
+    if(!ok || !cache_replace(temp_path, path)) remove(temp_path);
+}
@@ -0,0 +1,29 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "nob.h"
+
+// On-disk cache of generated code, one file per entry in a directory any
+// number of compilers can share. An entry is named after the hash of its
+// key and holds the key itself, so a hash collision is only a miss. It is
+// written to a temporary file first and renamed into place, a reader finds
+// a whole entry or none.
+typedef struct {
+    const char *dir;
+    size_t hits;
+    size_t misses;
+} Cache;
+
+// Creates dir when it is missing
+bool cache_open(Cache *cache, const char *dir);
+// Appends the static data and the code stored for key, false on a miss
+bool cache_load(Cache *cache, const char *key, size_t key_size, Nob_String_Builder *static_data, Nob_String_Builder *code);
+// Failing to store is not an error, the entry is compiled again next time
+void cache_store(Cache *cache, const char *key, size_t key_size,
+                 const char *static_data, size_t static_data_size,
+                 const char *code, size_t code_size);
+
+#endif // CACHE_H_
@@ -0,0 +1,51 @@
+#ifndef CHAR_CLASS_H_
+#define CHAR_CLASS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Byte classes for the lexer, a replacement for <ctype.h>: no locale and
+// well defined for negative chars. Bytes 0x80..0xFF belong to no class.
+
+typedef enum {
+    CHAR_SPACE       = 1 << 0, // ' ' '\t' '\n' '\v' '\f' '\r'
+    CHAR_DIGIT       = 1 << 1, // 0-9
+    CHAR_HEX_DIGIT   = 1 << 2, // 0-9 a-f A-F
+    CHAR_IDENT_START = 1 << 3, // a-z A-Z _
+    CHAR_IDENT       = 1 << 4, // a-z A-Z _ 0-9
+} CharClass;
+
+#define CC_S_ CHAR_SPACE
+#define CC_D_ (CHAR_DIGIT | CHAR_HEX_DIGIT | CHAR_IDENT)
+#define CC_H_ (CHAR_HEX_DIGIT | CHAR_IDENT_START | CHAR_IDENT)
+#define CC_L_ (CHAR_IDENT_START | CHAR_IDENT)
+
+static const uint8_t CHAR_CLASSES[256] = {
+    /* 0x00 */ 0,     0,     0,     0,     0,     0,     0,     0,     0,     CC_S_, CC_S_, CC_S_, CC_S_, CC_S_, 0,     0,
+    /* 0x10 */ 0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+    /* 0x20 */ CC_S_, 0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,     0,
+    /* 0x30 */ CC_D_, CC_D_, CC_D_, CC_D_, CC_D_, CC_D_, CC_D_, CC_D_, CC_D_, CC_D_, 0,     0,     0,     0,     0,     0,
+    /* 0x40 */ 0,     CC_H_, CC_H_, CC_H_, CC_H_, CC_H_, CC_H_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_,
+    /* 0x50 */ CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, 0,     0,     0,     0,     CC_L_,
+    /* 0x60 */ 0,     CC_H_, CC_H_, CC_H_, CC_H_, CC_H_, CC_H_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_,
+    /* 0x70 */ CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, CC_L_, 0,     0,     0,     0,     0,
+    // 0x80..0xFF are zero initialized
+};
+
+#undef CC_S_
+#undef CC_D_
+#undef CC_H_
+#undef CC_L_
+
+static inline bool char_is(char ch, CharClass classes)
+{
+    return (CHAR_CLASSES[(unsigned char)ch] & classes) != 0;
+}
+
+// Value of a byte that is known to be CHAR_HEX_DIGIT
+static inline int char_hex_value(char ch)
+{
+    return ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10;
+}
+
+#endif // CHAR_CLASS_H_
@@ -1,6 +1,6 @@
 #include "codegen.h"
 #include <assert.h>
-#include <src/lexer.h>
+#include "lexer.h"
 #include "nob.h"
 #include <stdlib.h>
 
@@ -16,29 +16,89 @@ const char *display_target(Target target)
     return NULL;
 }
 
-bool generate_program(Program *prog, Nob_String_Builder *output)
+void generate_program_prolog(Program *prog, Nob_String_Builder *output)
 {
     switch(prog->target) {
-        case TARGET_IR: 
-            {
-                for(size_t i = 0; i < prog->count_funcs; ++i) {
-                    dump_function(&prog->funcs[i]);
-                }
-            } break;
+        case TARGET_IR:
+            break;
+        case TARGET_FASM_X86_64_WIN32:
+            generate_fasm_x86_64_win32_program_prolog(output);
+            break;
+        default:
+            assert(0 && "Invalid target in generate_program_prolog");
+    }
+}
+
+bool generate_function(Program *prog, Function *fn, Nob_String_Builder *output)
+{
+    if(fn->static_end > fn->static_begin) generate_function_strings(prog, fn->name, fn->static_begin, output);
+    return generate_function_code(prog, fn, output);
+}
+
+void generate_function_strings(Program *prog, uint32_t name, size_t static_begin, Nob_String_Builder *output)
+{
+    switch(prog->target) {
+        case TARGET_IR:
+            break;
+        case TARGET_FASM_X86_64_WIN32:
+            generate_fasm_x86_64_win32_function_strings(output, interned_cstr(name), static_begin);
+            break;
+        default:
+            assert(0 && "Invalid target in generate_function_strings");
+    }
+}
+
+bool generate_function_code(Program *prog, Function *fn, Nob_String_Builder *output)
+{
+    switch(prog->target) {
+        case TARGET_IR:
+            dump_function(fn);
+            break;
+        case TARGET_FASM_X86_64_WIN32:
+            if(!generate_fasm_x86_64_win32_function(output, fn)) {
+                compiler_diagf(fn->loc, "Failed to compile function %s", interned_cstr(fn->name));
+                return false;
+            }
+            break;
+        default:
+            assert(0 && "Invalid target in generate_function_code");
+    }
+    return true;
+}
+
+void generate_program_epilog(Program *prog, Nob_String_Builder *output)
+{
+    switch(prog->target) {
+        case TARGET_IR:
+            break;
         case TARGET_FASM_X86_64_WIN32:
-            return generate_x86_64_program(prog, output);
+            generate_fasm_x86_64_win32_static_data(output, prog->static_data, prog->count_static_data);
+            generate_fasm_x86_64_win32_program_epilog(output);
+            break;
         default:
-            assert(0 && "Invalid target in generate_program");
+            assert(0 && "Invalid target in generate_program_epilog");
     }
+}
+
+bool generate_program(Program *prog, Nob_String_Builder *output)
+{
+    generate_program_prolog(prog, output);
+    for(size_t i = 0; i < prog->count_funcs; ++i) {
+        if(!generate_function(prog, &prog->funcs[i], output)) return false;
+    }
+    generate_program_epilog(prog, output);
     return true;
 }
 
 void optimize_function(Program *prog, Function *fn)
 {
+    (void)prog;
+    (void)fn;
 }
 
 void optimize_program(Program *prog)
 {
+    (void)prog;
 }
 
 Inst *push_inst(Function *fn, Inst inst)
@@ -95,9 +155,16 @@ const char *display_inst_kind(InstKind kind)
         case INST_GE: return "GE";
         case INST_EQ: return "EQ";
         case INST_NE: return "NE";
+        case INST_DIV: return "DIV";
+        case INST_MOD: return "MOD";
+        case INST_SHL: return "SHL";
+        case INST_SHR: return "SHR";
+        case INST_AND: return "AND";
+        case INST_OR: return "OR";
         case INST_BRANCH: return "BRANCH";
         case INST_LABEL: return "LABEL";
         case INST_STORE: return "STORE";
+        case INST_UPDATE: return "UPDATE";
         default: assert(0 && "Unreachable: invalid instruction kind at display_inst_kind");
     }
 }
@@ -113,7 +180,7 @@ bool expect_inst_arg(Inst inst, int arg_index, ArgKind kind)
                 display_arg_kind(inst.args[arg_index].kind));
         return false;
     }
-    if(kind == ARG_NAME && inst.args[arg_index].name == NULL) {
+    if(kind == ARG_NAME && inst.args[arg_index].name == 0) {
         compiler_diagf(inst.loc, "CODEGEN ERROR: Generated instruction '%s' argument '%d' is a name with value null", arg_index,
                 display_inst_kind(inst.kind));
         return false;
@@ -141,10 +208,10 @@ void dump_arg(Arg arg, const char *end)
             printf("static[%zu]%s", arg.static_offset, end);
             break;
         case ARG_NAME:
-            printf("\"%s\"%s", arg.name, end);
+            printf("\"%s\"%s", interned_cstr(arg.name), end);
             break;
         case ARG_INT_VALUE:
-            printf("$%lld%s", arg.int_value, end);
+            printf("$%lld%s", (long long)arg.int_value, end);
             break;
         case ARG_DEREF:
             printf("[#%zu]%s", arg.local_index, end);
@@ -162,7 +229,9 @@ void dump_arg(Arg arg, const char *end)
 
 void dump_function(Function *fn)
 {
-    printf("%s() [locals=%zu]\n", fn->name, fn->locals_count);
+    printf("%s(", interned_cstr(fn->name));
+    for(size_t i = 0; i < fn->params_count; ++i) printf(i > 0 ? ", #%zu" : "#%zu", i);
+    printf(") [locals=%zu]\n", fn->locals_count);
     for(size_t i = 0; i < fn->count; ++i) {
         Inst inst = fn->items[i];
         switch(inst.kind) {
@@ -185,6 +254,11 @@ void dump_function(Function *fn)
                 dump_arg(inst.args[0], ",");
                 dump_arg(inst.args[1], "\n");
                 break;
+            case INST_UPDATE:
+                printf("    _  = update %s ", display_inst_kind(inst.op));
+                dump_arg(inst.args[0], ", ");
+                dump_arg(inst.args[1], "\n");
+                break;
             case INST_EXTERN:
                 if(!expect_inst_arg(inst, 0, ARG_NAME)) return;
                 printf("    _ = extern ");
@@ -269,6 +343,42 @@ void dump_function(Function *fn)
                 dump_arg(inst.args[1], ", ");
                 dump_arg(inst.args[2], "\n");
                 break;
+            case INST_DIV:
+                if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return;
+                printf("    #%zu = div ", inst.args[0].local_index);
+                dump_arg(inst.args[1], ", ");
+                dump_arg(inst.args[2], "\n");
+                break;
+            case INST_MOD:
+                if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return;
+                printf("    #%zu = mod ", inst.args[0].local_index);
+                dump_arg(inst.args[1], ", ");
+                dump_arg(inst.args[2], "\n");
+                break;
+            case INST_SHL:
+                if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return;
+                printf("    #%zu = shl ", inst.args[0].local_index);
+                dump_arg(inst.args[1], ", ");
+                dump_arg(inst.args[2], "\n");
+                break;
+            case INST_SHR:
+                if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return;
+                printf("    #%zu = shr ", inst.args[0].local_index);
+                dump_arg(inst.args[1], ", ");
+                dump_arg(inst.args[2], "\n");
+                break;
+            case INST_AND:
+                if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return;
+                printf("    #%zu = and ", inst.args[0].local_index);
+                dump_arg(inst.args[1], ", ");
+                dump_arg(inst.args[2], "\n");
+                break;
+            case INST_OR:
+                if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return;
+                printf("    #%zu = or ", inst.args[0].local_index);
+                dump_arg(inst.args[1], ", ");
+                dump_arg(inst.args[2], "\n");
+                break;
             case INST_BRANCH:
                 if(!expect_inst_arg(inst, 0, ARG_LABEL)) return;
                 if(!expect_inst_arg(inst, 1, ARG_LABEL)) return;
@@ -4,8 +4,13 @@
 #include "lexer.h"
 #include "nob.h"
 #include "arena.h"
+#include "intern.h"
 #include <stdint.h>
 
+// Bump whenever the same tokens lower or generate to different code, the
+// entries of COMPILE CACHE made by older versions are missed from then on
+#define CODEGEN_VERSION 1
+
 typedef enum {
     ARG_NONE = 0,
     ARG_INT_VALUE,
@@ -30,7 +35,7 @@ struct Arg {
         size_t local_index;
         size_t label;
         size_t static_offset;
-        char *name;
+        uint32_t name; // interned
         int64_t int_value;
         ArgList list;
         size_t deref_local_index;
@@ -61,6 +66,11 @@ typedef enum {
     // store arg[0].deref_local_index, arg[1]
     INST_STORE,
 
+    // update arg[0].local or arg[0].deref_local_index, op, arg[1]: the
+    // lvalue becomes lvalue op arg[1], op being one of the binops below
+    // other than the comparisons
+    INST_UPDATE,
+
     // jmp arg[0].block
     INST_JMP,
 
@@ -80,6 +90,12 @@ typedef enum {
     INST_GE,
     INST_EQ,
     INST_NE,
+    INST_DIV,
+    INST_MOD,
+    INST_SHL,
+    INST_SHR, // arithmetic
+    INST_AND,
+    INST_OR,
 
     // label arg[0].label_index
     INST_LABEL,
@@ -88,6 +104,7 @@ typedef enum {
 typedef struct {
     Loc loc;
     InstKind kind;
+    InstKind op; // of an INST_UPDATE
     Arg args[3];
 } Inst;
 
@@ -96,9 +113,14 @@ typedef struct {
     Inst *items;
     size_t count;
     size_t capacity;
-    char *name;
+    uint32_t name; // interned
+    // Locals #0 to #params_count - 1 are the parameters, in order
+    size_t params_count;
     size_t locals_count;
     size_t labels_count;
+    // Its string literals in the static data
+    size_t static_begin;
+    size_t static_end;
 } Function;
 
 // TODO: prefix the functions
@@ -138,7 +160,24 @@ const char *display_target(Target target);
 void emit_target_output(Target target, Nob_String_Builder output);
 
 void optimize_program(Program *prog);
-bool generate_x86_64_program(Program *prog, Nob_String_Builder *output);
+
+void generate_fasm_x86_64_win32_program_prolog(Nob_String_Builder *output);
+void generate_fasm_x86_64_win32_function_strings(Nob_String_Builder *output, const char *name, size_t static_begin);
+bool generate_fasm_x86_64_win32_function(Nob_String_Builder *output, Function *fn);
+void generate_fasm_x86_64_win32_static_data(Nob_String_Builder *output, const char *static_data, size_t static_data_length);
+void generate_fasm_x86_64_win32_program_epilog(Nob_String_Builder *output);
+
 bool generate_program(Program *prog, Nob_String_Builder *output);
+// generate_program() in pieces: the prolog, every function in order and
+// the epilog. A function only appends to output, so functions can be
+// generated into separate builders and concatenated.
+void generate_program_prolog(Program *prog, Nob_String_Builder *output);
+bool generate_function(Program *prog, Function *fn, Nob_String_Builder *output);
+void generate_program_epilog(Program *prog, Nob_String_Builder *output);
+// generate_function() in pieces. The code of a function addresses its
+// string literals from where they start, which the strings piece defines
+// ahead of it, so the code stays the same wherever they land.
+void generate_function_strings(Program *prog, uint32_t name, size_t static_begin, Nob_String_Builder *output);
+bool generate_function_code(Program *prog, Function *fn, Nob_String_Builder *output);
 
 #endif // CODEGEN_H_
@@ -1,5 +1,6 @@
 #include "codegen.h"
 #include <assert.h>
+#include <stdio.h>
 #include "lexer.h"
 
 void generate_fasm_x86_64_win32_program_prolog(Nob_String_Builder *output)
@@ -28,28 +29,76 @@ void generate_fasm_x86_64_win32_static_data(Nob_String_Builder *output, const ch
     }
 }
 
-static bool load_arg(Nob_String_Builder *output, Inst inst, int arg_index, const char *dst)
+// FRAME
+//
+// The first four parameters arrive in rcx, rdx, r8 and r9 and are moved to
+// the callee-saved r12 to r15 on entry, where they stay for the whole
+// function: calls do not clobber them and nothing here uses those
+// registers for anything else. The bulan source has no way to take the
+// address of a variable, so none of them ever needs a stack slot. The
+// parameters after those stay where the caller put them, above the
+// return address and the 32 bytes of shadow space. Below rbp are the
+// saved r12 to r15 that are in use, then every other local.
+
+static const char *PARAM_REGISTERS[] = { "rcx", "rdx", "r8", "r9", };
+static const char *SAVED_PARAM_REGISTERS[] = { "r12", "r13", "r14", "r15", };
+
+static size_t register_params_count(const Function *fn)
+{
+    return fn->params_count < NOB_ARRAY_LEN(SAVED_PARAM_REGISTERS) ? fn->params_count : NOB_ARRAY_LEN(SAVED_PARAM_REGISTERS);
+}
+
+typedef struct {
+    char text[32];
+} Operand;
+
+// Where local #index of fn lives, as a register or a memory operand
+static Operand local_operand(const Function *fn, size_t index)
+{
+    Operand operand = {0};
+    size_t saved = register_params_count(fn);
+    if(index < saved) {
+        snprintf(operand.text, sizeof(operand.text), "%s", SAVED_PARAM_REGISTERS[index]);
+    } else if(index < fn->params_count) {
+        snprintf(operand.text, sizeof(operand.text), "QWORD [rbp + %zu]", 16 + index * 8);
+    } else {
+        snprintf(operand.text, sizeof(operand.text), "QWORD [rbp - %zu]", (saved + index - fn->params_count + 1) * 8);
+    }
+    return operand;
+}
+
+// The string literals of a function start at _<name>.strings in the static
+// data, see generate_fasm_x86_64_win32_function_strings()
+static void load_static_data(Nob_String_Builder *output, const Function *fn, size_t offset, const char *dst)
+{
+    assert(fn->static_begin <= offset && offset < fn->static_end);
+    nob_sb_appendf(output, "    mov %s, static_data\n", dst);
+    if(offset > fn->static_begin)
+        nob_sb_appendf(output, "    add %s, _%s.strings + %zu\n", dst, interned_cstr(fn->name), offset - fn->static_begin);
+    else
+        nob_sb_appendf(output, "    add %s, _%s.strings\n", dst, interned_cstr(fn->name));
+}
+
+static bool load_arg(Nob_String_Builder *output, const Function *fn, Inst inst, int arg_index, const char *dst)
 {
     assert(arg_index >= 0 && arg_index < 3);
     Arg arg = inst.args[arg_index];
     switch(arg.kind) {
         case ARG_LOCAL_INDEX:
             {
-                nob_sb_appendf(output, "    mov %s, QWORD [rbp - %zu]\n", dst, (arg.local_index + 1) * 8);
+                nob_sb_appendf(output, "    mov %s, %s\n", dst, local_operand(fn, arg.local_index).text);
             } break;
         case ARG_INT_VALUE:
             {
-                nob_sb_appendf(output, "    mov %s, %lld\n", dst, arg.int_value);
+                nob_sb_appendf(output, "    mov %s, %lld\n", dst, (long long)arg.int_value);
             } break;
         case ARG_STATIC_DATA:
             {
-                nob_sb_appendf(output, "    mov rax, static_data\n");
-                if(arg.static_offset > 0) 
-                    nob_sb_appendf(output, "    add rax, %zu\n", arg.static_offset);
+                load_static_data(output, fn, arg.static_offset, dst);
             } break;
         case ARG_DEREF:
             {
-                nob_sb_appendf(output, "    mov %s, QWORD [rbp - %zu]\n", dst, (arg.local_index + 1) * 8);
+                nob_sb_appendf(output, "    mov %s, %s\n", dst, local_operand(fn, arg.deref_local_index).text);
                 nob_sb_appendf(output, "    mov %s, QWORD [%s]\n", dst, dst);
             } break;
         default:
@@ -65,15 +114,116 @@ static bool load_arg(Nob_String_Builder *output, Inst inst, int arg_index, const
     return true;
 }
 
+// INST_UPDATE works on the lvalue where it lives: a register, a stack
+// slot, or through the pointer in r11, which nothing else here touches
+static bool generate_update(Nob_String_Builder *output, const Function *fn, Inst inst)
+{
+    size_t saved = register_params_count(fn);
+    Arg lvalue = inst.args[0];
+    Arg value = inst.args[1];
+    bool in_register = lvalue.kind == ARG_LOCAL_INDEX && lvalue.local_index < saved;
+    bool shift = inst.op == INST_SHL || inst.op == INST_SHR;
+    bool divide = inst.op == INST_DIV || inst.op == INST_MOD;
+    bool immediate = value.kind == ARG_INT_VALUE && INT32_MIN <= value.int_value && value.int_value <= INT32_MAX && !divide;
+
+    // The value is used as it is when it can be, and at most one of the
+    // two operands is in memory
+    Operand src = {0};
+    if(immediate) {
+        snprintf(src.text, sizeof(src.text), "%lld", (long long)(shift ? value.int_value & 63 : value.int_value));
+    } else if(value.kind == ARG_LOCAL_INDEX && !shift && !divide && (in_register || value.local_index < saved)) {
+        src = local_operand(fn, value.local_index);
+    } else {
+        const char *reg = shift || divide ? "rcx" : "rdx";
+        if(!load_arg(output, fn, inst, 1, reg)) return false;
+        snprintf(src.text, sizeof(src.text), "%s", shift ? "cl" : reg);
+    }
+
+    Operand dst = {0};
+    switch(lvalue.kind) {
+        case ARG_LOCAL_INDEX:
+            dst = local_operand(fn, lvalue.local_index);
+            break;
+        case ARG_DEREF:
+            nob_sb_appendf(output, "    mov r11, %s\n", local_operand(fn, lvalue.deref_local_index).text);
+            snprintf(dst.text, sizeof(dst.text), "QWORD [r11]");
+            break;
+        default:
+            compiler_diagf(inst.loc, "CODEGEN ERROR: Invalid argument 0 for instruction %s with type %s",
+                    display_inst_kind(inst.kind),
+                    display_arg_kind(lvalue.kind));
+            return false;
+    }
+
+    switch(inst.op) {
+        case INST_ADD:
+        case INST_SUB:
+        case INST_AND:
+        case INST_OR:
+        case INST_SHL:
+        case INST_SHR:
+            {
+                const char *mnemonic = inst.op == INST_ADD ? "add" :
+                                       inst.op == INST_SUB ? "sub" :
+                                       inst.op == INST_AND ? "and" :
+                                       inst.op == INST_OR  ? "or"  :
+                                       inst.op == INST_SHL ? "shl" : "sar";
+                nob_sb_appendf(output, "    %s %s, %s\n", mnemonic, dst.text, src.text);
+            } break;
+        case INST_MUL:
+            // imul has no memory destination
+            if(in_register) {
+                if(immediate) nob_sb_appendf(output, "    imul %s, %s, %s\n", dst.text, dst.text, src.text);
+                else          nob_sb_appendf(output, "    imul %s, %s\n", dst.text, src.text);
+            } else {
+                if(immediate) {
+                    nob_sb_appendf(output, "    imul rax, %s, %s\n", dst.text, src.text);
+                } else {
+                    nob_sb_appendf(output, "    mov  rax, %s\n", dst.text);
+                    nob_sb_appendf(output, "    imul rax, %s\n", src.text);
+                }
+                nob_sb_appendf(output, "    mov  %s, rax\n", dst.text);
+            }
+            break;
+        case INST_DIV:
+        case INST_MOD:
+            nob_sb_appendf(output, "    mov  rax, %s\n", dst.text);
+            nob_sb_appendf(output, "    cqo\n");
+            nob_sb_appendf(output, "    idiv rcx\n");
+            nob_sb_appendf(output, "    mov  %s, %s\n", dst.text, inst.op == INST_DIV ? "rax" : "rdx");
+            break;
+        default:
+            compiler_diagf(inst.loc, "CODEGEN ERROR: Invalid operation %s for instruction %s",
+                    display_inst_kind(inst.op),
+                    display_inst_kind(inst.kind));
+            return false;
+    }
+    return true;
+}
+
+void generate_fasm_x86_64_win32_function_strings(Nob_String_Builder *output, const char *name, size_t static_begin)
+{
+    nob_sb_appendf(output, "_%s.strings equ %zu\n", name, static_begin);
+}
+
 bool generate_fasm_x86_64_win32_function(Nob_String_Builder *output, Function *fn)
 {
-    nob_sb_appendf(output, "public %s as '_%s'\n", fn->name, fn->name);
-    nob_sb_appendf(output, "_%s:\n", fn->name);
+    const char *name = interned_cstr(fn->name);
+    nob_sb_appendf(output, "public %s as '_%s'\n", name, name);
+    nob_sb_appendf(output, "_%s:\n", name);
     nob_sb_appendf(output, "    push rbp\n");
     nob_sb_appendf(output, "    mov  rbp, rsp\n");
+    size_t saved = register_params_count(fn);
+    size_t slots = saved + fn->locals_count - fn->params_count;
     // Align stack to 16 byte for windows only
-    if(fn->locals_count % 2 != 0) fn->locals_count += 1;
-    nob_sb_appendf(output, "    sub rsp, %zu\n", fn->locals_count * 8);
+    if(slots % 2 != 0) slots += 1;
+    // Plus the 32 bytes of shadow space callees may spill their register
+    // parameters to, which would land on our locals otherwise
+    nob_sb_appendf(output, "    sub rsp, %zu\n", slots * 8 + 32);
+    for(size_t i = 0; i < saved; ++i) {
+        nob_sb_appendf(output, "    mov QWORD [rbp - %zu], %s\n", (i + 1) * 8, SAVED_PARAM_REGISTERS[i]);
+        nob_sb_appendf(output, "    mov %s, %s\n", SAVED_PARAM_REGISTERS[i], PARAM_REGISTERS[i]);
+    }
 
     for(size_t i = 0; i < fn->count; ++i) {
         Inst inst = fn->items[i];
@@ -87,119 +237,149 @@ bool generate_fasm_x86_64_win32_function(Nob_String_Builder *output, Function *f
             case INST_LOCAL_INIT:
                 if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                 nob_sb_appendf(output, "    sub rsp, 8\n");
-                nob_sb_appendf(output, "    mov QWORD [rbp - %zu], 0\n", (inst.args[0].local_index + 1) * 8);
+                nob_sb_appendf(output, "    mov %s, 0\n", local_operand(fn, inst.args[0].local_index).text);
                 break;
             case INST_LT:
                 {
-                    if(!load_arg(output, inst, 1, "rax")) return false;
-                    if(!load_arg(output, inst, 2, "rdx")) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rdx")) return false;
                     nob_sb_appendf(output, "    cmp   rax, rdx\n");
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                     nob_sb_appendf(output, "    mov   rax, 0\n");
                     nob_sb_appendf(output, "    setl  al\n");
-                    nob_sb_appendf(output, "    mov   QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov   %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_LE:
                 {
-                    if(!load_arg(output, inst, 1, "rax")) return false;
-                    if(!load_arg(output, inst, 2, "rdx")) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rdx")) return false;
                     nob_sb_appendf(output, "    cmp   rax, rdx\n");
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                     nob_sb_appendf(output, "    mov   rax, 0\n");
                     nob_sb_appendf(output, "    setle al\n");
-                    nob_sb_appendf(output, "    mov   QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov   %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_GT:
                 {
-                    if(!load_arg(output, inst, 1, "rax")) return false;
-                    if(!load_arg(output, inst, 2, "rdx")) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rdx")) return false;
                     nob_sb_appendf(output, "    cmp   rax, rdx\n");
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                     nob_sb_appendf(output, "    mov   rax, 0\n");
                     nob_sb_appendf(output, "    setg  al\n");
-                    nob_sb_appendf(output, "    mov   QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov   %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_GE:
                 {
-                    if(!load_arg(output, inst, 1, "rax")) return false;
-                    if(!load_arg(output, inst, 2, "rdx")) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rdx")) return false;
                     nob_sb_appendf(output, "    cmp   rax, rdx\n");
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                     nob_sb_appendf(output, "    mov   rax, 0\n");
                     nob_sb_appendf(output, "    setge al\n");
-                    nob_sb_appendf(output, "    mov   QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov   %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_EQ:
                 {
-                    if(!load_arg(output, inst, 1, "rax")) return false;
-                    if(!load_arg(output, inst, 2, "rdx")) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rdx")) return false;
                     nob_sb_appendf(output, "    cmp   rax, rdx\n");
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                     nob_sb_appendf(output, "    mov   rax, 0\n");
                     nob_sb_appendf(output, "    sete  al\n");
-                    nob_sb_appendf(output, "    mov   QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov   %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_NE:
                 {
-                    if(!load_arg(output, inst, 1, "rax")) return false;
-                    if(!load_arg(output, inst, 2, "rdx")) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rdx")) return false;
                     nob_sb_appendf(output, "    cmp   rax, rdx\n");
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                     nob_sb_appendf(output, "    mov   rax, 0\n");
                     nob_sb_appendf(output, "    setne al\n");
-                    nob_sb_appendf(output, "    mov   QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov   %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_ADD:
                 {
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
-                    load_arg(output, inst, 1, "rax");
-                    load_arg(output, inst, 2, "rdx");
+                    load_arg(output, fn, inst, 1, "rax");
+                    load_arg(output, fn, inst, 2, "rdx");
                     nob_sb_appendf(output, "    add rax, rdx\n");
-                    nob_sb_appendf(output, "    mov QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_MUL:
                 {
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
-                    load_arg(output, inst, 1, "rax");
-                    load_arg(output, inst, 2, "rbx");
-                    nob_sb_appendf(output, "    imul rax, rbx\n");
-                    nob_sb_appendf(output, "    mov  QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    load_arg(output, fn, inst, 1, "rax");
+                    load_arg(output, fn, inst, 2, "rdx");
+                    nob_sb_appendf(output, "    imul rax, rdx\n");
+                    nob_sb_appendf(output, "    mov  %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_SUB:
                 {
                     if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
-                    load_arg(output, inst, 1, "rax");
-                    load_arg(output, inst, 2, "rdx");
+                    load_arg(output, fn, inst, 1, "rax");
+                    load_arg(output, fn, inst, 2, "rdx");
                     nob_sb_appendf(output, "    sub rax, rdx\n");
-                    nob_sb_appendf(output, "    mov QWORD [rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
+                } break;
+            case INST_DIV:
+            case INST_MOD:
+                {
+                    if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rcx")) return false;
+                    nob_sb_appendf(output, "    cqo\n");
+                    nob_sb_appendf(output, "    idiv rcx\n");
+                    nob_sb_appendf(output, "    mov  %s, %s\n", local_operand(fn, inst.args[0].local_index).text,
+                            inst.kind == INST_DIV ? "rax" : "rdx");
+                } break;
+            case INST_SHL:
+            case INST_SHR:
+                {
+                    if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rcx")) return false;
+                    nob_sb_appendf(output, "    %s  rax, cl\n", inst.kind == INST_SHL ? "shl" : "sar");
+                    nob_sb_appendf(output, "    mov  %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
+                } break;
+            case INST_AND:
+            case INST_OR:
+                {
+                    if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
+                    if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                    if(!load_arg(output, fn, inst, 2, "rdx")) return false;
+                    nob_sb_appendf(output, "    %s  rax, rdx\n", inst.kind == INST_AND ? "and" : "or ");
+                    nob_sb_appendf(output, "    mov  %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                 } break;
             case INST_STORE:
                 {
-                    if(!load_arg(output, inst, 1, "rdx")) return false;
+                    if(!load_arg(output, fn, inst, 1, "rdx")) return false;
                     if(!expect_inst_arg(inst, 0, ARG_DEREF)) return false;
-                    nob_sb_appendf(output, "    mov rax, QWORD [rbp - %zu]\n", (inst.args[0].deref_local_index + 1) * 8);
+                    nob_sb_appendf(output, "    mov rax, %s\n", local_operand(fn, inst.args[0].deref_local_index).text);
                     nob_sb_appendf(output, "    mov QWORD [rax], rdx\n");
                 } break;
+            case INST_UPDATE:
+                if(!generate_update(output, fn, inst)) return false;
+                break;
             case INST_LOCAL_ASSIGN:
                 if(!expect_inst_arg(inst, 0, ARG_LOCAL_INDEX)) return false;
                 switch(inst.args[1].kind) {
                     case ARG_LOCAL_INDEX:
-                        nob_sb_appendf(output, "    mov rax, QWORD [rbp - %zu]\n", 
-                                (inst.args[1].local_index + 1) * 8);
-                        nob_sb_appendf(output, "    mov QWORD [rbp - %zu], rax\n", 
-                                (inst.args[0].local_index + 1) * 8);
+                        nob_sb_appendf(output, "    mov rax, %s\n", local_operand(fn, inst.args[1].local_index).text);
+                        nob_sb_appendf(output, "    mov %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                         break;
                     case ARG_INT_VALUE:
-                        nob_sb_appendf(output, "    mov QWORD [rbp - %zu], %lld\n", 
-                                (inst.args[0].local_index + 1) * 8, 
-                                inst.args[1].int_value);
+                        nob_sb_appendf(output, "    mov %s, %lld\n", local_operand(fn, inst.args[0].local_index).text,
+                                (long long)inst.args[1].int_value);
                         break;
                     case ARG_STATIC_DATA:
-                        nob_sb_appendf(output, "    mov rax, static_data\n");
-                        if(inst.args[1].static_offset > 0) 
-                            nob_sb_appendf(output, "    add rax, %zu\n", inst.args[1].static_offset);
-                        nob_sb_appendf(output, "    mov QWORD [rbp - %zu], rax\n", 
-                                (inst.args[0].local_index + 1) * 8);
+                        load_static_data(output, fn, inst.args[1].static_offset, "rax");
+                        nob_sb_appendf(output, "    mov %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
+                        break;
+                    case ARG_DEREF:
+                        if(!load_arg(output, fn, inst, 1, "rax")) return false;
+                        nob_sb_appendf(output, "    mov %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
                         break;
                     default:
                         compiler_diagf(inst.loc, "CODEGEN ERROR: Invalid argument 1 for instruction %s with type %s", 
@@ -217,12 +397,14 @@ bool generate_fasm_x86_64_win32_function(Nob_String_Builder *output, Function *f
                 if(!expect_inst_arg(inst, 1, ARG_LABEL)) return false;
                 switch(inst.args[2].kind) {
                     case ARG_LOCAL_INDEX:
-                        nob_sb_appendf(output, "    mov rax, QWORD [rbp - %zu]\n", 
-                                (inst.args[2].local_index + 1) * 8);
+                        nob_sb_appendf(output, "    mov rax, %s\n", local_operand(fn, inst.args[2].local_index).text);
                         break;
                     case ARG_INT_VALUE:
                         nob_sb_appendf(output, "    mov rax, %lld\n", 
-                                inst.args[2].int_value);
+                                (long long)inst.args[2].int_value);
+                        break;
+                    case ARG_DEREF:
+                        if(!load_arg(output, fn, inst, 2, "rax")) return false;
                         break;
                     default:
                         compiler_diagf(inst.loc, "CODEGEN ERROR: Invalid argument 1 for instruction %s with type %s", 
@@ -230,13 +412,13 @@ bool generate_fasm_x86_64_win32_function(Nob_String_Builder *output, Function *f
                                 display_arg_kind(inst.args[1].kind));
                         break;
                 }
-                nob_sb_appendf(output, "    cmp  rax, 1\n");
-                nob_sb_appendf(output, "    je  .L%zu\n", inst.args[0].label);
+                nob_sb_appendf(output, "    cmp  rax, 0\n");
+                nob_sb_appendf(output, "    jne .L%zu\n", inst.args[0].label);
                 nob_sb_appendf(output, "    jmp .L%zu\n", inst.args[1].label);
                 break;
             case INST_EXTERN:
                 if(!expect_inst_arg(inst, 0, ARG_NAME)) return false;
-                nob_sb_appendf(output, "    extrn %s\n", inst.args[0].name);
+                nob_sb_appendf(output, "    extrn %s\n", interned_cstr(inst.args[0].name));
                 break;
             case INST_FUNCALL:
                 {
@@ -244,34 +426,31 @@ bool generate_fasm_x86_64_win32_function(Nob_String_Builder *output, Function *f
                     if(!expect_inst_arg(inst, 1, ARG_NAME)) return false;
                     if(!expect_inst_arg(inst, 2, ARG_LIST)) return false;
 
-                    static const char *WIN32_PARAM_REGISTERS[] = { "rcx", "rdx", "r8", "r9", };
-                    static const char *LINUX_PARAM_REGISTERS[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9", };
-                    const char **param_registers = WIN32_PARAM_REGISTERS;
-                    uint32_t param_registers_count = NOB_ARRAY_LEN(WIN32_PARAM_REGISTERS);
+                    const char **param_registers = PARAM_REGISTERS;
+                    uint32_t param_registers_count = NOB_ARRAY_LEN(PARAM_REGISTERS);
 
-                    // If WIN32 only
+                    // The arguments past the registers go above a shadow space
+                    // of their own, keeping rsp 16 byte aligned
                     size_t rest = 0;
                     if(inst.args[2].list.count > param_registers_count) {
-                        rest = inst.args[2].list.count - param_registers_count;
-                        nob_sb_appendf(output, "    sub rsp, %zu\n", rest * 8);
+                        rest = 32 + (inst.args[2].list.count - param_registers_count + 1) / 2 * 16;
+                        nob_sb_appendf(output, "    sub rsp, %zu\n", rest);
                     }
 
                     for(size_t i = 0; i < inst.args[2].list.count; ++i) {
                         Arg arg = inst.args[2].list.items[i]; 
                         switch(arg.kind) {
                             case ARG_LOCAL_INDEX:
-                                nob_sb_appendf(output, "    mov rax, QWORD[rbp - %zu]\n", (arg.local_index + 1) * 8);
+                                nob_sb_appendf(output, "    mov rax, %s\n", local_operand(fn, arg.local_index).text);
                                 break;
                             case ARG_INT_VALUE:
-                                nob_sb_appendf(output, "    mov rax, %lld\n", arg.int_value);
+                                nob_sb_appendf(output, "    mov rax, %lld\n", (long long)arg.int_value);
                                 break;
                             case ARG_STATIC_DATA:
-                                nob_sb_appendf(output, "    mov rax, static_data\n");
-                                if(arg.static_offset > 0) 
-                                    nob_sb_appendf(output, "    add rax, %zu\n", arg.static_offset);
+                                load_static_data(output, fn, arg.static_offset, "rax");
                                 break;
                             case ARG_DEREF:
-                                nob_sb_appendf(output, "    mov rax, QWORD [rbp - %zu]\n", (arg.local_index + 1) * 8);
+                                nob_sb_appendf(output, "    mov rax, %s\n", local_operand(fn, arg.deref_local_index).text);
                                 nob_sb_appendf(output, "    mov rax, QWORD [rax]\n");
                                 break;
                             default:
@@ -286,34 +465,22 @@ bool generate_fasm_x86_64_win32_function(Nob_String_Builder *output, Function *f
                         if(i < param_registers_count) {
                             nob_sb_appendf(output, "    mov %s, rax\n", param_registers[i]);
                         } else {
-                            nob_sb_appendf(output, "    mov QWORD[rbp - %zu], rax\n", i - param_registers_count);
+                            nob_sb_appendf(output, "    mov QWORD [rsp + %zu], rax\n", i * 8);
                         }
                     }
 
-                    nob_sb_appendf(output, "    call %s\n", inst.args[1].name);
-                    nob_sb_appendf(output, "    mov  QWORD[rbp - %zu], rax\n", (inst.args[0].local_index + 1) * 8);
-                    if(rest > 0) nob_sb_appendf(output, "    add  rsp, %zu\n", rest * 8);
+                    nob_sb_appendf(output, "    call %s\n", interned_cstr(inst.args[1].name));
+                    nob_sb_appendf(output, "    mov  %s, rax\n", local_operand(fn, inst.args[0].local_index).text);
+                    if(rest > 0) nob_sb_appendf(output, "    add  rsp, %zu\n", rest);
                 }
                 break;
         }
     }
+    for(size_t i = 0; i < saved; ++i) {
+        nob_sb_appendf(output, "    mov %s, QWORD [rbp - %zu]\n", SAVED_PARAM_REGISTERS[i], (i + 1) * 8);
+    }
     nob_sb_appendf(output, "    mov rsp, rbp\n");
     nob_sb_appendf(output, "    pop rbp\n");
     nob_sb_appendf(output, "    ret\n");
     return true;
 }
-
-bool generate_x86_64_program(Program *prog, Nob_String_Builder *output)
-{
-    generate_fasm_x86_64_win32_program_prolog(output);
-    for(size_t i = 0; i < prog->count_funcs; ++i) {
-        Function *fn = &prog->funcs[i];
-        if(!generate_fasm_x86_64_win32_function(output, fn)) {
-            compiler_diagf(fn->loc, "Failed to compile function %s", fn->name);
-            return false;
-        }
-    }
-    generate_fasm_x86_64_win32_static_data(output, prog->static_data, prog->count_static_data);
-    generate_fasm_x86_64_win32_program_epilog(output);
-    return true;
-}
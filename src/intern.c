@@ -0,0 +1,136 @@
+#include "intern.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+typedef struct {
+    const char *data;
+    uint32_t length;
+    uint32_t hash;
+} Interned;
+
+#define INTERN_FIRST_CHUNK 512
+#define INTERN_CHUNKS 24
+
+typedef struct {
+    Arena arena;
+
+    // Entry id - 1 counted across the chunks, chunk k holds
+    // INTERN_FIRST_CHUNK << k entries. Entries never move, so other
+    // threads can look up the ids handed to them while more are interned.
+    Interned *chunks[INTERN_CHUNKS];
+    size_t count_entries;
+
+    // Open addressing with linear probing over ids, 0 is an empty slot
+    uint32_t *slots;
+    size_t slots_capacity;
+} Interner;
+
+static Interner interner = {0};
+
+static Interned *intern_entry(uint32_t id)
+{
+    assert(id > 0);
+    size_t index = id - 1;
+    size_t chunk = 0;
+    while(index >= (size_t)INTERN_FIRST_CHUNK << chunk) {
+        index -= (size_t)INTERN_FIRST_CHUNK << chunk;
+        chunk += 1;
+    }
+    assert(chunk < INTERN_CHUNKS && interner.chunks[chunk] != NULL);
+    return &interner.chunks[chunk][index];
+}
+
+static uint32_t intern_hash(const char *data, size_t length)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void intern_grow_slots(void)
+{
+    size_t capacity = interner.slots_capacity == 0 ? 1024 : interner.slots_capacity * 2;
+    uint32_t *slots = calloc(capacity, sizeof(*slots));
+    assert(slots != NULL && "Buy more RAM LOL!");
+    for(size_t i = 0; i < interner.count_entries; ++i) {
+        size_t slot = intern_entry((uint32_t)(i + 1))->hash & (capacity - 1);
+        while(slots[slot] != 0) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = (uint32_t)(i + 1);
+    }
+    free(interner.slots);
+    interner.slots = slots;
+    interner.slots_capacity = capacity;
+}
+
+uint32_t intern(const char *data, size_t length)
+{
+    // Keep the load factor under one half
+    if((interner.count_entries + 1) * 2 > interner.slots_capacity) intern_grow_slots();
+
+    uint32_t hash = intern_hash(data, length);
+    size_t mask = interner.slots_capacity - 1;
+    size_t slot = hash & mask;
+    while(interner.slots[slot] != 0) {
+        Interned *entry = intern_entry(interner.slots[slot]);
+        if(entry->hash == hash && entry->length == length && memcmp(entry->data, data, length) == 0) {
+            return interner.slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    char *copy = arena_alloc(&interner.arena, length + 1);
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+
+    // Chunk k starts at entry INTERN_FIRST_CHUNK*(2^k - 1)
+    size_t start = interner.count_entries / INTERN_FIRST_CHUNK + 1;
+    if(interner.count_entries % INTERN_FIRST_CHUNK == 0 && (start & (start - 1)) == 0) {
+        size_t chunk = 0;
+        while(((size_t)1 << chunk) < start) chunk += 1;
+        assert(chunk < INTERN_CHUNKS && "Buy more RAM LOL!");
+        interner.chunks[chunk] = malloc(((size_t)INTERN_FIRST_CHUNK << chunk) * sizeof(Interned));
+        assert(interner.chunks[chunk] != NULL && "Buy more RAM LOL!");
+    }
+    uint32_t id = (uint32_t)++interner.count_entries;
+    *intern_entry(id) = (Interned) {
+        .data = copy,
+        .length = (uint32_t)length,
+        .hash = hash,
+    };
+    interner.slots[slot] = id;
+    return id;
+}
+
+uint32_t intern_cstr(const char *cstr)
+{
+    return intern(cstr, strlen(cstr));
+}
+
+const char *interned_cstr(uint32_t id)
+{
+    return intern_entry(id)->data;
+}
+
+size_t interned_length(uint32_t id)
+{
+    return intern_entry(id)->length;
+}
+
+size_t interned_count(void)
+{
+    return interner.count_entries;
+}
+
+void intern_free(void)
+{
+    arena_free(&interner.arena);
+    for(size_t i = 0; i < INTERN_CHUNKS; ++i) free(interner.chunks[i]);
+    free(interner.slots);
+    interner = (Interner){0};
+}
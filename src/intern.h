@@ -0,0 +1,20 @@
+#ifndef INTERN_H_
+#define INTERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Process wide string interner. Every distinct string gets a stable id
+// and exactly one NUL-terminated copy, so names compare by id. Id 0 is
+// never handed out and means "no name". Only one thread may intern, but
+// other threads can read the ids it hands them (interned_cstr(),
+// interned_length()) while it goes on.
+
+uint32_t intern(const char *data, size_t length);
+uint32_t intern_cstr(const char *cstr);
+const char *interned_cstr(uint32_t id);
+size_t interned_length(uint32_t id);
+size_t interned_count(void);
+void intern_free(void);
+
+#endif // INTERN_H_
@@ -27,29 +27,248 @@
  * THE SOFTWARE.
  */
 #include "lexer.h"
+#include "scan.h"
+#include "intern.h"
+#include "char_class.h"
+#include "number.h"
+#include "thread.h"
+#include "queue.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <string.h>
 
 typedef struct {
     const char *literal;
+    size_t length;
     Token token;
 } TokenToLit;
 
-static TokenToLit PUNCTS[] = {
-#define X(TOK, STR) (TokenToLit) { .token = TOKEN_##TOK, .literal = STR, },
+static const TokenToLit PUNCTS[] = {
+#define X(TOK, STR) (TokenToLit) { .token = TOKEN_##TOK, .literal = STR, .length = sizeof(STR) - 1, },
     PUNCT_TOKEN_LIST
 #undef X
 };
 
 static const TokenToLit KEYWORDS[] = {
-#define X(TOK, STR) (TokenToLit) { .token = TOKEN_##TOK, .literal = STR, },
+#define X(TOK, STR) (TokenToLit) { .token = TOKEN_##TOK, .literal = STR, .length = sizeof(STR) - 1, },
     KEYWORD_TOKEN_LIST
 #undef X
 };
 
+// TOKEN SETS
+//
+// The punctuations and keywords a lexer recognizes, compiled into lookup
+// tables. The built-in set comes from PUNCT_TOKEN_LIST and
+// KEYWORD_TOKEN_LIST and is built by the first lexer_new(), C can't index
+// a table by a string literal's byte at compile time. A lexer with
+// registered tokens compiles its own set, see lexer_register_punct().
+
+#define TOKEN_SET_CAPACITY 128
+
+typedef struct {
+    uint8_t begin;
+    uint8_t count;
+} TokenBucket;
+
+// Perfect hash over (length, first byte, last byte) of the keywords. The
+// seed is searched until every keyword lands in its own slot, so lookup
+// is a single probe followed by one memcmp. Sets where no seed turns up
+// within KEYWORD_HASH_BUDGET probes look keywords up by first byte, like
+// punctuations.
+#define KEYWORD_HASH_BITS 8
+#define KEYWORD_HASH_SLOTS (1u << KEYWORD_HASH_BITS)
+#define KEYWORD_HASH_BUDGET (1u << 22)
+
+struct TokenSet {
+    // Grouped by their first byte with the longest literal first in each group
+    TokenToLit puncts[TOKEN_SET_CAPACITY];
+    TokenBucket punct_buckets[256];
+    TokenToLit keywords[TOKEN_SET_CAPACITY];
+    TokenBucket keyword_buckets[256];
+    uint32_t keyword_seed; // 0 when there is no perfect hash
+    uint8_t keyword_slots[KEYWORD_HASH_SLOTS]; // index into keywords plus one, zero is empty
+    size_t longest_punct;
+};
+
+static TokenSet builtin_token_set = {0};
+static bool builtin_token_set_ready = false;
+
+static void token_set_group(TokenToLit *grouped, TokenBucket *buckets, const TokenToLit *items, size_t count)
+{
+    size_t begin = 0;
+    for(int ch = 0; ch < 256; ++ch) {
+        size_t bucket_count = 0;
+        for(size_t i = 0; i < count; ++i) {
+            if((unsigned char)items[i].literal[0] != ch) continue;
+            // insertion sort, longest literal first
+            size_t j = begin + bucket_count;
+            while(j > begin && grouped[j - 1].length < items[i].length) {
+                grouped[j] = grouped[j - 1];
+                j -= 1;
+            }
+            grouped[j] = items[i];
+            bucket_count += 1;
+        }
+        buckets[ch].begin = (uint8_t)begin;
+        buckets[ch].count = (uint8_t)bucket_count;
+        begin += bucket_count;
+    }
+}
+
+static uint32_t lexer_keyword_hash(uint32_t seed, const char *text, size_t length)
+{
+    uint32_t key = (uint32_t)length
+                 | ((uint32_t)(unsigned char)text[0] << 8)
+                 | ((uint32_t)(unsigned char)text[length - 1] << 16);
+    return (key * seed) >> (32 - KEYWORD_HASH_BITS);
+}
+
+static void token_set_hash_keywords(TokenSet *set, size_t count)
+{
+    set->keyword_seed = 0;
+    if(count == 0) return;
+    // Keywords that agree on length, first and last byte collide for any seed
+    for(size_t i = 0; i < count; ++i) {
+        for(size_t j = i + 1; j < count; ++j) {
+            TokenToLit a = set->keywords[i], b = set->keywords[j];
+            if(a.length == b.length && a.literal[0] == b.literal[0] && a.literal[a.length - 1] == b.literal[b.length - 1]) return;
+        }
+    }
+    uint32_t seed = 0x9E3779B1;
+    for(size_t probes = 0; probes < KEYWORD_HASH_BUDGET; probes += count, seed += 2) {
+        memset(set->keyword_slots, 0, sizeof(set->keyword_slots));
+        bool collided = false;
+        for(size_t i = 0; i < count && !collided; ++i) {
+            uint32_t slot = lexer_keyword_hash(seed, set->keywords[i].literal, set->keywords[i].length);
+            if(set->keyword_slots[slot] != 0) collided = true;
+            set->keyword_slots[slot] = (uint8_t)(i + 1);
+        }
+        if(!collided) {
+            set->keyword_seed = seed;
+            return;
+        }
+    }
+}
+
+static void token_set_compile(TokenSet *set, const TokenToLit *puncts, size_t count_puncts, const TokenToLit *keywords, size_t count_keywords)
+{
+    assert(count_puncts <= TOKEN_SET_CAPACITY && count_keywords <= TOKEN_SET_CAPACITY);
+    token_set_group(set->puncts, set->punct_buckets, puncts, count_puncts);
+    set->longest_punct = 0;
+    for(size_t i = 0; i < count_puncts; ++i) {
+        if(puncts[i].length > set->longest_punct) set->longest_punct = puncts[i].length;
+    }
+    token_set_group(set->keywords, set->keyword_buckets, keywords, count_keywords);
+    token_set_hash_keywords(set, count_keywords);
+}
+
+static void lexer_build_builtin_token_set(void)
+{
+    if(builtin_token_set_ready) return;
+    static_assert(ARRAY_LEN(PUNCTS) <= TOKEN_SET_CAPACITY, "Too many punctuations for a TokenSet");
+    static_assert(ARRAY_LEN(KEYWORDS) <= TOKEN_SET_CAPACITY, "Too many keywords for a TokenSet");
+    token_set_compile(&builtin_token_set, PUNCTS, ARRAY_LEN(PUNCTS), KEYWORDS, ARRAY_LEN(KEYWORDS));
+    builtin_token_set_ready = true;
+}
+
+static Token token_set_keyword(const TokenSet *set, const char *text, size_t length)
+{
+    if(length == 0) return TOKEN_ID;
+    if(set->keyword_seed != 0) {
+        uint8_t index = set->keyword_slots[lexer_keyword_hash(set->keyword_seed, text, length)];
+        if(index == 0) return TOKEN_ID;
+        TokenToLit t = set->keywords[index - 1];
+        if(t.length != length || memcmp(text, t.literal, length) != 0) return TOKEN_ID;
+        return t.token;
+    }
+    TokenBucket bucket = set->keyword_buckets[(unsigned char)text[0]];
+    for(size_t i = bucket.begin; i < (size_t)bucket.begin + bucket.count; ++i) {
+        TokenToLit t = set->keywords[i];
+        if(t.length == length && memcmp(text, t.literal, length) == 0) return t.token;
+    }
+    return TOKEN_ID;
+}
+
+Token lexer_keyword_token(const char *text, size_t length)
+{
+    lexer_build_builtin_token_set();
+    return token_set_keyword(&builtin_token_set, text, length);
+}
+
+// REGISTERED TOKENS
+
+static bool lexer_register_token(Lexer *lex, int token, const char *literal, bool is_keyword)
+{
+    if(lex->count_tokens >= ARRAY_LEN(lex->tokens)) return false;
+    // Value tokens carry a payload and token kinds are stored in a byte
+    static_assert(TOKEN_FLOAT_LIT + 1 == TOKEN_QUESTION, "Value tokens must come right before the punctuations");
+    if(token <= TOKEN_FLOAT_LIT || token > UINT8_MAX) return false;
+    for(size_t i = 0; i < lex->count_tokens; ++i) {
+        if(lex->tokens[i].is_keyword == is_keyword && strcmp(lex->tokens[i].literal, literal) == 0) return false;
+    }
+    const char *display = is_keyword ? "keyword `%s`" : "`%s`";
+    size_t display_size = strlen(display) + strlen(literal);
+    char *display_text = arena_alloc(&lex->arena, display_size);
+    snprintf(display_text, display_size, display, literal);
+    lex->tokens[lex->count_tokens++] = (TokenInfo) {
+        .token = token,
+        .literal = arena_strdup(&lex->arena, literal),
+        .is_keyword = is_keyword,
+        .display = display_text,
+    };
+
+    // Compiled once the lexer scans its first token
+    lex->token_set = NULL;
+    return true;
+}
+
+static void lexer_compile_token_set(Lexer *lex)
+{
+    TokenSet *set = arena_alloc(&lex->arena, sizeof(TokenSet));
+    TokenToLit puncts[ARRAY_LEN(lex->tokens)];
+    TokenToLit keywords[ARRAY_LEN(lex->tokens)];
+    size_t count_puncts = 0, count_keywords = 0;
+    for(size_t i = 0; i < lex->count_tokens; ++i) {
+        TokenInfo info = lex->tokens[i];
+        TokenToLit t = { .literal = info.literal, .length = strlen(info.literal), .token = (Token)info.token };
+        if(info.is_keyword) keywords[count_keywords++] = t;
+        else puncts[count_puncts++] = t;
+    }
+    token_set_compile(set, puncts, count_puncts, keywords, count_keywords);
+    lex->token_set = set;
+}
+
+bool lexer_register_punct(Lexer *lex, int token, const char *literal)
+{
+    // Anything else would start a different kind of token, or a comment,
+    // which the scanner looks for before punctuations
+    if(literal[0] == '\0' || char_is(literal[0], CHAR_IDENT | CHAR_SPACE)) return false;
+    if(literal[0] == '"' || literal[0] == '\'') return false;
+    if(strncmp(literal, "//", 2) == 0 || strncmp(literal, "/*", 2) == 0) return false;
+    // lexer_match_punct() assumes a punctuation never spans lines
+    if(strchr(literal, '\n') != NULL) return false;
+    return lexer_register_token(lex, token, literal, false);
+}
+
+bool lexer_register_keyword(Lexer *lex, int token, const char *literal)
+{
+    if(!char_is(literal[0], CHAR_IDENT_START)) return false;
+    for(const char *p = literal; *p != '\0'; ++p) {
+        if(!char_is(*p, CHAR_IDENT)) return false;
+    }
+    return lexer_register_token(lex, token, literal, true);
+}
+
+void lexer_register_builtin_tokens(Lexer *lex)
+{
+    for(size_t i = 0; i < ARRAY_LEN(PUNCTS); ++i) {
+        lexer_register_punct(lex, PUNCTS[i].token, PUNCTS[i].literal);
+    }
+    for(size_t i = 0; i < ARRAY_LEN(KEYWORDS); ++i) {
+        lexer_register_keyword(lex, KEYWORDS[i].token, KEYWORDS[i].literal);
+    }
+}
 
 const char *lexer_display_token(Token token)
 {
@@ -72,27 +291,179 @@ const char *lexer_display_token(Token token)
         #define X(TOK, STR) case TOKEN_##TOK: return "keyword `"STR"`";
             KEYWORD_TOKEN_LIST
         #undef X
+
+        case _COUNT_TOKENS: break;
     }
     fprintf(stderr, "ERROR: unknown token %d. This is unexpected\n", token);
     return "Unknown token";
 }
 
+const char *lexer_display_token_of(Lexer *lex, Token token)
+{
+    for(size_t i = 0; i < lex->count_tokens; ++i) {
+        if(lex->tokens[i].token == (int)token) return lex->tokens[i].display;
+    }
+    return lexer_display_token(token);
+}
+
+// SOURCES
+
+typedef struct {
+    char *input_path;
+    char *input_stream;
+    char *eof;
+    Loc base;
+    // Offsets of the first byte of every line, built on the first lookup
+    uint32_t *line_starts;
+    size_t count_lines;
+} Source;
+
+static struct {
+    Source *items;
+    size_t count;
+    size_t capacity;
+} sources = {0};
+
+// Offsets start at 1 so an uninitialized Loc never points into a source
+static Loc sources_end = 1;
+
+Loc source_register(char *input_path, char *input_stream, char *eof)
+{
+    size_t size = (size_t)(eof - input_stream);
+    // One past the end is still a valid location, that's where EOF is
+    assert(size < (size_t)(UINT32_MAX - sources_end) && "Source is too big for a 32 bit Loc");
+    if(sources.count + 1 > sources.capacity) {
+        sources.capacity = sources.capacity == 0 ? 16 : sources.capacity * 2;
+        sources.items = realloc(sources.items, sources.capacity * sizeof(*sources.items));
+        assert(sources.items != NULL && "Buy more RAM LOL!");
+    }
+    Loc base = sources_end;
+    sources.items[sources.count++] = (Source) {
+        .input_path = input_path,
+        .input_stream = input_stream,
+        .eof = eof,
+        .base = base,
+    };
+    sources_end += (Loc)size + 1;
+    return base;
+}
+
+Loc source_update(Loc base, char *input_stream, char *eof)
+{
+    size_t index = 0;
+    while(index < sources.count && sources.items[index].base != base) index += 1;
+    assert(index < sources.count && "Updating a source that was never registered");
+    Source *source = &sources.items[index];
+
+    size_t size = (size_t)(eof - input_stream);
+    bool last = index + 1 == sources.count;
+    if(!last && (size_t)base + size + 1 > sources.items[index + 1].base) {
+        return source_register(source->input_path, input_stream, eof);
+    }
+    if(last) {
+        assert(size < (size_t)(UINT32_MAX - base) && "Source is too big for a 32 bit Loc");
+        sources_end = base + (Loc)size + 1;
+    }
+    free(source->line_starts);
+    source->line_starts = NULL;
+    source->count_lines = 0;
+    source->input_stream = input_stream;
+    source->eof = eof;
+    return base;
+}
+
+static void source_build_line_starts(Source *source)
+{
+    const char *last_line = NULL;
+    size_t count = scan_count_newlines(source->input_stream, source->eof, &last_line) + 1;
+    source->line_starts = malloc(count * sizeof(*source->line_starts));
+    assert(source->line_starts != NULL && "Buy more RAM LOL!");
+    source->line_starts[0] = 0;
+    source->count_lines = 1;
+    const char *current = source->input_stream;
+    while((current = scan_find_byte(current, source->eof, '\n')) < source->eof) {
+        current += 1;
+        source->line_starts[source->count_lines++] = (uint32_t)(current - source->input_stream);
+    }
+    assert(source->count_lines == count);
+}
+
+LocInfo loc_info(Loc loc)
+{
+    // Sources are registered with increasing bases, find the last one that starts at or before loc
+    size_t lo = 0, hi = sources.count;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(sources.items[mid].base <= loc) lo = mid + 1;
+        else hi = mid;
+    }
+    if(loc == 0 || lo == 0) {
+        return (LocInfo) { .input_path = "<unknown>", .line_number = 0, .line_offset = 0 };
+    }
+
+    Source *source = &sources.items[lo - 1];
+    if(source->line_starts == NULL) source_build_line_starts(source);
+    uint32_t offset = loc - source->base;
+
+    lo = 0, hi = source->count_lines;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(source->line_starts[mid] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return (LocInfo) {
+        .input_path = source->input_path,
+        .line_number = (int)lo,
+        .line_offset = (int)(offset - source->line_starts[lo - 1]) + 1,
+    };
+}
+
+// DIAGNOSTICS
+
+static _Thread_local bool diags_muted = false;
+
+void compiler_mute_diags(bool muted)
+{
+    diags_muted = muted;
+}
+
+static void compiler_vdiagf(Loc loc, const char *fmt, va_list ap)
+{
+    // Also keeps muted threads away from the lazily built line tables
+    if(diags_muted) return;
+    LocInfo info = loc_info(loc);
+    fprintf(stderr, "%s:%d:%d: ", info.input_path, info.line_number, info.line_offset);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+}
+
 void compiler_diagf(Loc loc, const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    fprintf(stderr, "%s:%d:%d: ", loc.input_path, loc.line_number, loc.line_offset);
-    vfprintf(stderr, fmt, ap);
-    fputc('\n', stderr);
+    compiler_vdiagf(loc, fmt, ap);
+    va_end(ap);
+}
+
+// Errors found while scanning. A speculative lexer stays quiet, whatever
+// it ran into is lexed again for real, see lexer_tokenize_parallel().
+static void lexer_diagf(Lexer *lex, Loc loc, const char *fmt, ...)
+{
+    if(lex->speculative) return;
+    va_list ap;
+    va_start(ap, fmt);
+    compiler_vdiagf(loc, fmt, ap);
     va_end(ap);
 }
 
 #define compiler_missingf(loc, ...) _compiler_missingf(__FILE__, __LINE__, loc, __VA_ARGS__)
 void _compiler_missingf(const char *file, int line, Loc loc, const char *fmt, ...)
 {
+    if(diags_muted) return;
     va_list ap;
     va_start(ap, fmt);
-    fprintf(stderr, "%s:%d:%d: todo: ", loc.input_path, loc.line_number, loc.line_offset);
+    LocInfo info = loc_info(loc);
+    fprintf(stderr, "%s:%d:%d: todo: ", info.input_path, info.line_number, info.line_offset);
     vfprintf(stderr, fmt, ap);
     fprintf(stderr, "\n%s:%d: info: implementation should go here\n", file, line);
     va_end(ap);
@@ -100,57 +471,73 @@ void _compiler_missingf(const char *file, int line, Loc loc, const char *fmt, ..
 
 Lexer lexer_new(char *input_path, char *input_stream, char *eof)
 {
+    assert(*eof == '\0' && "Input must be followed by a NUL sentinel");
     Lexer lex = {0};
     lex.input_path = input_path;
     lex.input_stream = input_stream;
     lex.eof = eof;
+    lex.source_base = source_register(input_path, input_stream, eof);
     lex.parse_point.current = input_stream;
-    lex.parse_point.line_start = input_stream;
-    lex.parse_point.line_number = 1;
+    // Before any worker thread of lexer_tokenize_parallel() could race for
+    // the tables
+    lexer_build_tables();
+    lex.token_set = &builtin_token_set;
     return lex;
 }
 
+void lexer_reset(Lexer *lex, char *input_stream, char *eof)
+{
+    assert(*eof == '\0' && "Input must be followed by a NUL sentinel");
+    assert(lex->feed == NULL && "Resetting a lexer that is fed");
+    lex->input_stream = input_stream;
+    lex->eof = eof;
+    lex->source_base = source_update(lex->source_base, input_stream, eof);
+    lex->parse_point = (ParsePoint){ .current = input_stream };
+    lex->stream = NULL;
+    lex->lookahead_count = 0;
+    arena_reset(&lex->arena);
+}
+
+void lexer_build_tables(void)
+{
+    lexer_build_builtin_token_set();
+    scan_ensure_selected();
+}
+
 bool lexer_is_eof(Lexer *lex)
 {
     return lex->parse_point.current >= lex->eof;
 }
 
+// The cursor never moves past eof and *eof is the sentinel, so this
+// reads 0 at the end of the input without a bounds check
 char lexer_peek_char(Lexer *lex)
 {
-    if(lexer_is_eof(lex)) return 0;
     return *lex->parse_point.current;
 }
 
 void lexer_skip_char(Lexer *lex)
 {
     assert(!lexer_is_eof(lex));
-    char ch = *lex->parse_point.current;
     lex->parse_point.current += 1;
-    if(ch == '\n') {
-        lex->parse_point.line_start   = lex->parse_point.current;
-        lex->parse_point.line_number += 1;
-    }
+}
+
+void lexer_skip_to(Lexer *lex, char *end)
+{
+    assert(lex->parse_point.current <= end && end <= lex->eof);
+    lex->parse_point.current = end;
 }
 
 void lexer_skip_whitespace(Lexer *lex)
 {
-    char ch;
-    while((ch = lexer_peek_char(lex)) != 0) {
-        if(isspace(ch)) {
-            lexer_skip_char(lex);
-        } else {
-            break;
-        }
-    }
+    lexer_skip_to(lex, (char*)scan_skip_whitespace(lex->parse_point.current, lex->eof));
 }
 
 bool lexer_skip_prefix(Lexer *lex, const char *prefix)
 {
     ParsePoint saved_point = lex->parse_point;
-    char ch = 0;
     while(*prefix != 0) {
-        ch = lexer_peek_char(lex);
-        if(ch == 0 || ch != *prefix) {
+        if(lexer_peek_char(lex) != *prefix) {
             lex->parse_point = saved_point;
             return false;
         }
@@ -162,108 +549,218 @@ bool lexer_skip_prefix(Lexer *lex, const char *prefix)
 
 void lexer_skip_until(Lexer *lex, const char *prefix)
 {
-    while(!lexer_is_eof(lex) && !lexer_skip_prefix(lex, prefix)) {
+    while(!lexer_is_eof(lex)) {
+        lexer_skip_to(lex, (char*)scan_find_byte(lex->parse_point.current, lex->eof, prefix[0]));
+        if(lexer_is_eof(lex) || lexer_skip_prefix(lex, prefix)) break;
         lexer_skip_char(lex);
     }
 }
 
+// Compares byte by byte so the sentinel mismatches before anything past
+// eof is read, which memcmp() does not promise
+static bool lexer_match_literal(const char *current, const char *literal, size_t length)
+{
+    for(size_t i = 1; i < length; ++i) {
+        if(current[i] != literal[i]) return false;
+    }
+    return true;
+}
+
+// Punctuations never contain a newline so the cursor can jump over the
+// whole literal without going through lexer_skip_char().
+bool lexer_match_punct(Lexer *lex)
+{
+    char *current = lex->parse_point.current;
+    const TokenSet *set = lex->token_set;
+    TokenBucket bucket = set->punct_buckets[(unsigned char)*current];
+    for(size_t i = bucket.begin; i < (size_t)bucket.begin + bucket.count; ++i) {
+        TokenToLit t = set->puncts[i];
+        if(lexer_match_literal(current, t.literal, t.length)) {
+            lex->parse_point.current += t.length;
+            lex->token = t.token;
+            return true;
+        }
+    }
+    return false;
+}
+
 bool lexer_is_identifier(char ch) 
 {
-    return isalnum(ch) != 0 || ch == '_';
+    return char_is(ch, CHAR_IDENT);
 }
 
 bool lexer_is_identifier_start(char ch)
 {
-    return isalpha(ch) != 0 || ch == '_';
+    return char_is(ch, CHAR_IDENT_START);
 }
 
 Loc lexer_loc(Lexer *lex)
 {
-    return (Loc) {
-        .input_path = lex->input_path,
-        .line_number = lex->parse_point.line_number,
-        .line_offset = (int)(size_t)(lex->parse_point.current - lex->parse_point.line_start) + 1,
-    };
+    return lex->source_base + (Loc)(lex->parse_point.current - lex->input_stream);
 }
 
-void lexer_storage_append(Lexer *lex, char ch)
+// Returns the byte an escape sequence `\\ch` stands for, or -1
+static int lexer_unescape(char ch, char delim)
 {
-    if(lex->string_storage.count + 1 > lex->string_storage.capacity) {
-        if(lex->string_storage.capacity == 0) {
-            lex->string_storage.capacity  = 32;
-        } else {
-            lex->string_storage.capacity *= 2;
-        }
-
-        void *new_items = malloc(lex->string_storage.capacity * sizeof(*lex->string_storage.items));
-        assert(new_items != NULL && "Buy more RAM LOL!");
-        memcpy(new_items, lex->string_storage.items, lex->string_storage.count * sizeof(*lex->string_storage.items));
-        free(lex->string_storage.items);
-        lex->string_storage.items = new_items;
+    switch(ch) {
+        case '0':  return '\0';
+        case 'n':  return '\n';
+        case 't':  return '\t';
+        case '\\': return '\\';
+        default:   return ch == delim ? delim : -1;
     }
-    lex->string_storage.items[lex->string_storage.count++] = ch;
 }
 
-bool lexer_parse_string_into_storage(Lexer *lex, char delim)
+// Walks a literal up to its closing delim without copying it anywhere.
+// Reports how long it is once decoded and whether it had any escape
+// sequence, a literal without one can stay a view into the input.
+bool lexer_scan_string(Lexer *lex, char delim, size_t *decoded_length, bool *escaped)
 {
     char ch = 0;
+    *decoded_length = 0;
+    *escaped = false;
     while((ch = lexer_peek_char(lex)) != 0) {
         if(ch == '\\') {
             lexer_skip_char(lex);
             ch = lexer_peek_char(lex);
-            if(ch == 0) {
+            if(ch == 0 || lexer_unescape(ch, delim) < 0) {
                 lex->token = TOKEN_PARSING_ERROR;
-                compiler_diagf(lexer_loc(lex), "LEXER ERROR: unfinished escape sequence");
+                lexer_diagf(lex, lexer_loc(lex), "LEXER ERROR: unfinished escape sequence");
                 return false;
             }
-            char nch = 0;
-            switch(ch) {
-                case '0':
-                    nch = '\0';
-                    break;
-                case 'n':
-                    nch = '\n';
-                    break;
-                case 't':
-                    nch = '\t';
-                    break;
-                case '\\':
-                    nch = '\\';
-                    break;
-                default:
-                    if(ch == delim) {
-                        nch = delim;
-                    } else {
-                        lex->token = TOKEN_PARSING_ERROR;
-                        compiler_diagf(lexer_loc(lex), "LEXER ERROR: unfinished escape sequence");
-                        return false;
-                    }
-                    break;
-            }
-
-            lexer_storage_append(lex, nch);
-            lexer_skip_char(lex);
+            *escaped = true;
         } else if(ch == delim) {
             break;
+        }
+        *decoded_length += 1;
+        lexer_skip_char(lex);
+    }
+    return true;
+}
+
+// Decodes a literal already validated by lexer_scan_string()
+static void lexer_decode_string(const char *begin, const char *end, char delim, char *output)
+{
+    while(begin < end) {
+        if(*begin == '\\') {
+            begin += 1;
+            *output++ = (char)lexer_unescape(*begin, delim);
         } else {
-            lexer_storage_append(lex, ch);
-            lexer_skip_char(lex);
+            *output++ = *begin;
         }
+        begin += 1;
     }
+}
+
+// NUMBERS
+//
+// The syntax of number literals is checked here, number.c only converts
+// text that is known to be well formed.
+
+// Skips `[+-]? [0-9]+` after an exponent marker. Returns NULL when that
+// is not what follows, `1else` is still `1` and `else`.
+static char *lexer_skip_exponent(Lexer *lex, char *exponent)
+{
+    if(*exponent == '+' || *exponent == '-') exponent += 1;
+    if(!char_is(*exponent, CHAR_DIGIT)) return NULL;
+    return (char*)scan_skip_digits(exponent, lex->eof);
+}
+
+static bool lexer_number_out_of_range(Lexer *lex, const char *message)
+{
+    lexer_diagf(lex, lex->loc, "LEXER ERROR: %s", message);
+    lex->token = TOKEN_PARSING_ERROR;
+    return false;
+}
+
+// [0-9]+ ('.' [0-9]+)? ([eE] [+-]? [0-9]+)?
+static bool lexer_scan_decimal_number(Lexer *lex)
+{
+    char *begin = lex->parse_point.current;
+    char *end = (char*)scan_skip_digits(begin, lex->eof);
+    bool real = false;
+    // A digit has to follow the dot, so `1.` is not a float literal
+    if(end[0] == '.' && char_is(end[1], CHAR_DIGIT)) {
+        end = (char*)scan_skip_digits(end + 1, lex->eof);
+        real = true;
+    }
+    char *exponent = NULL;
+    if((*end == 'e' || *end == 'E') && (exponent = lexer_skip_exponent(lex, end + 1)) != NULL) {
+        end = exponent;
+        real = true;
+    }
+    lexer_skip_to(lex, end);
+
+    if(real) {
+        lex->token = TOKEN_FLOAT_LIT;
+        if(!number_decimal_to_double(begin, end, &lex->real_number)) return lexer_number_out_of_range(lex, "float literal does not fit in a double");
+        return true;
+    }
+
+    lex->token = TOKEN_INT_LIT;
+    uint64_t value = 0;
+    if(!number_decimal_to_u64(begin, end, &value) || value > INT64_MAX) return lexer_number_out_of_range(lex, "integer literal does not fit in 64 bits");
+    lex->int_number = (int64_t)value;
     return true;
 }
 
-bool lexer_get_token(Lexer *lex)
+// After `0x`: [0-9a-fA-F]* for integers, floats follow C and need the
+// binary exponent: [0-9a-fA-F]* ('.' [0-9a-fA-F]*)? [pP] [+-]? [0-9]+
+static bool lexer_scan_hex_number(Lexer *lex)
+{
+    char *begin = lex->parse_point.current;
+    char *end = begin;
+    while(char_is(*end, CHAR_HEX_DIGIT)) end += 1;
+    size_t digits = (size_t)(end - begin);
+
+    bool fraction = *end == '.';
+    if(fraction) {
+        char *fraction_begin = end + 1;
+        end = fraction_begin;
+        while(char_is(*end, CHAR_HEX_DIGIT)) end += 1;
+        digits += (size_t)(end - fraction_begin);
+    }
+    char *exponent = NULL;
+    if(digits > 0 && (*end == 'p' || *end == 'P')) exponent = lexer_skip_exponent(lex, end + 1);
+    if(fraction && exponent == NULL) {
+        lexer_skip_to(lex, end);
+        lexer_diagf(lex, lex->loc, "LEXER ERROR: hexadecimal float literal needs digits and a `p` exponent");
+        lex->token = TOKEN_PARSING_ERROR;
+        return false;
+    }
+
+    if(exponent != NULL) {
+        end = exponent;
+        lexer_skip_to(lex, end);
+        lex->token = TOKEN_FLOAT_LIT;
+        if(!number_hex_to_double(begin, end, &lex->real_number)) return lexer_number_out_of_range(lex, "float literal does not fit in a double");
+        return true;
+    }
+
+    lexer_skip_to(lex, end);
+    lex->token = TOKEN_INT_LIT;
+    uint64_t value = 0;
+    if(!number_hex_to_u64(begin, end, &value)) return lexer_number_out_of_range(lex, "integer literal does not fit in 64 bits");
+    // Hexadecimal literals may use all 64 bits, they are taken as a bit pattern
+    lex->int_number = (int64_t)value;
+    return true;
+}
+
+static bool lexer_scan_token(Lexer *lex)
 {
+    if(lex->token_set == NULL) lexer_compile_token_set(lex);
+    lex->scanned_tokens += 1;
     while(true) {
         lexer_skip_whitespace(lex);
         if(lexer_skip_prefix(lex, "//")) {
-            lexer_skip_until(lex, "\n");
+            // the newline itself is left for lexer_skip_whitespace()
+            lexer_skip_to(lex, (char*)scan_find_byte(lex->parse_point.current, lex->eof, '\n'));
             continue;
         }
 
         if(lexer_skip_prefix(lex, "/*")) {
-            lexer_skip_until(lex, "*/");
+            lexer_skip_to(lex, (char*)scan_find_comment_end(lex->parse_point.current, lex->eof));
+            lexer_skip_prefix(lex, "*/");
             continue;
         }
 
@@ -271,6 +768,7 @@ bool lexer_get_token(Lexer *lex)
     }
 
     lex->loc = lexer_loc(lex);
+    lex->token_offset = (size_t)(lex->parse_point.current - lex->input_stream);
 
     char ch = lexer_peek_char(lex);
     if(ch == 0) {
@@ -278,140 +776,716 @@ bool lexer_get_token(Lexer *lex)
         return false;
     }
 
-    for(int i = 0; i < (int)ARRAY_LEN(PUNCTS); ++i) {
-        TokenToLit t = PUNCTS[i];
-        if(lexer_skip_prefix(lex, t.literal)) {
-            lex->token = t.token;
-            return true;
-        }
+    if(lexer_match_punct(lex)) {
+        return true;
     }
 
     if(lexer_is_identifier_start(ch)) {
-        lex->token = TOKEN_ID;
-        lex->string_storage.count = 0;
-        while((ch = lexer_peek_char(lex)) != 0) {
-            if(lexer_is_identifier(ch)) {
-                lexer_storage_append(lex, ch);
-                lexer_skip_char(lex);
-            } else {
-                break;
-            }
-        }
-
-        lexer_storage_append(lex, 0);
-        lex->string = lex->string_storage.items;
-        for(int i = 0; i < (int)ARRAY_LEN(KEYWORDS); ++i) {
-            TokenToLit t = KEYWORDS[i];
-            if(strcmp(lex->string, t.literal) == 0) {
-                lex->token = t.token;
-                return true;
-            }
-        }
+        // Identifiers never span lines, the token is a view into the input
+        char *end = (char*)scan_skip_identifier(lex->parse_point.current + 1, lex->eof);
+        lex->string = lex->parse_point.current;
+        lex->string_length = (size_t)(end - lex->parse_point.current);
+        lex->parse_point.current = end;
+        lex->token = token_set_keyword(lex->token_set, lex->string, lex->string_length);
+        // Interning is left to whoever stitches the chunks of a speculative lexer
+        if(lex->token == TOKEN_ID && !lex->speculative) lex->id = intern(lex->string, lex->string_length);
         return true;
     }
 
     if(lexer_skip_prefix(lex, "0x")) {
-        lex->token = TOKEN_INT_LIT;
-        lex->int_number = 0;
-        while((ch = lexer_peek_char(lex)) != 0) {
-            if(isdigit(ch) != 0) {
-                lex->int_number *= 16;
-                lex->int_number += ((int64_t)ch) - ((int64_t)'0');
-                lexer_skip_char(lex);
-            } else if('a' <= ch && ch <= 'f') {
-                lex->int_number *= 16;
-                lex->int_number += ((int64_t)ch) - ((int64_t)'a') + 10;
-                lexer_skip_char(lex);
-            } else if('A' <= ch && ch <= 'F') {
-                lex->int_number *= 16;
-                lex->int_number += ((int64_t)ch) - ((int64_t)'A') + 10;
-                lexer_skip_char(lex);
-            } else {
-                break;
-            }
-        }
-        return true;
+        return lexer_scan_hex_number(lex);
     }
 
-    if(isdigit(ch) != 0) {
-        lex->token = TOKEN_INT_LIT;
-        lex->int_number = 0;
-        while((ch = lexer_peek_char(lex)) != 0) {
-            // TODO: check for overflows?
-            if(isdigit(ch) != 0) {
-                lex->int_number *= 10;
-                lex->int_number += (int64_t)ch - (int64_t)'0';
-                lexer_skip_char(lex);
-            } else {
-                break;
-            }
-        }
-        return true;
+    if(char_is(ch, CHAR_DIGIT)) {
+        return lexer_scan_decimal_number(lex);
     }
 
     if(ch == '"') {
         lexer_skip_char(lex);
         lex->token = TOKEN_STRING_LIT;
-        lex->string_storage.count = 0;
-        if(!lexer_parse_string_into_storage(lex, '"')) {
+        char *begin = lex->parse_point.current;
+        size_t length = 0;
+        bool escaped = false;
+        if(!lexer_scan_string(lex, '"', &length, &escaped)) {
             return false;
         }
-        if(lexer_is_eof(lex)) {
-            compiler_diagf(lexer_loc(lex), "LEXER ERROR: unfinished string literal"); 
-            compiler_diagf(lex->loc, "LEXER INFO: literal starts here"); 
+        if(lexer_peek_char(lex) == 0) {
+            lexer_diagf(lex, lexer_loc(lex), "LEXER ERROR: unfinished string literal"); 
+            lexer_diagf(lex, lex->loc, "LEXER INFO: literal starts here"); 
             lex->token = TOKEN_PARSING_ERROR;
             return false;
         }
+        char *end = lex->parse_point.current;
         lexer_skip_char(lex);
-        lexer_storage_append(lex, 0);
-        lex->string = lex->string_storage.items;
+        if(escaped) {
+            // Only literals with escape sequences are materialized
+            char *decoded = arena_alloc(&lex->arena, length + 1);
+            lexer_decode_string(begin, end, '"', decoded);
+            decoded[length] = '\0';
+            lex->string = decoded;
+        } else {
+            lex->string = begin;
+        }
+        lex->string_length = length;
         return true;
     }
 
     if(ch == '\'') {
         lexer_skip_char(lex);
         lex->token = TOKEN_CHAR_LIT;
-        lex->string_storage.count = 0;
-        if(!lexer_parse_string_into_storage(lex, '\'')) {
+        char *begin = lex->parse_point.current;
+        size_t length = 0;
+        bool escaped = false;
+        if(!lexer_scan_string(lex, '\'', &length, &escaped)) {
             return false;
         }
-        if(lexer_is_eof(lex)) {
-            compiler_diagf(lexer_loc(lex), "LEXER ERROR: Unfinished character literal");
-            compiler_diagf(lex->loc, "LEXER INFO: Literal starts here");
+        if(lexer_peek_char(lex) == 0) {
+            lexer_diagf(lex, lexer_loc(lex), "LEXER ERROR: Unfinished character literal");
+            lexer_diagf(lex, lex->loc, "LEXER INFO: Literal starts here");
             lex->token = TOKEN_PARSING_ERROR;
             return false;
         }
+        char *end = lex->parse_point.current;
         lexer_skip_char(lex);
-        if(lex->string_storage.count == 0) {
-            compiler_diagf(lex->loc, "LEXER ERROR: Empty character literal");
+        if(length == 0) {
+            lexer_diagf(lex, lex->loc, "LEXER ERROR: Empty character literal");
             lex->token = TOKEN_PARSING_ERROR;
             return false;
         }
-        if (lex->string_storage.count > 2) {
+        if (length > 2) {
             // TODO: maybe we should allow more on targets with 64 bits?
             // TODO: such error should not terminate the compilation
-            compiler_diagf(lex->loc, "LEXER ERROR: Character literal contains more than two characters");
+            lexer_diagf(lex, lex->loc, "LEXER ERROR: Character literal contains more than two characters");
             lex->token = TOKEN_PARSING_ERROR;
             return false;
         }
+        char decoded[2];
+        lexer_decode_string(begin, end, '\'', decoded);
         lex->int_number = 0;
-        for(size_t i = 0; i < lex->string_storage.count; ++i) {
+        for(size_t i = 0; i < length; ++i) {
             lex->int_number *= 0x100;
-            lex->int_number += lex->string_storage.items[i];
+            lex->int_number += decoded[i];
         }
         return true;
     }
 
-    compiler_diagf(lex->loc, "LEXER ERROR: invalid char '%c' -> '%d' for any token parsing", 
+    lexer_diagf(lex, lex->loc, "LEXER ERROR: invalid char '%c' -> '%d' for any token parsing", 
             lex->parse_point.current,lex->parse_point.current );
     lex->token = TOKEN_PARSING_ERROR;
     return false;
 }
 
+static bool lexer_replay_token(Lexer *lex)
+{
+    TokenStream *stream = lex->stream;
+    size_t index = lex->parse_point.token_index;
+    assert(index < stream->count);
+    // The last token of a stream is either EOF or a parsing error, keep
+    // returning it just like the scanner would
+    if(index + 1 < stream->count) lex->parse_point.token_index = index + 1;
+
+    lex->token = stream->kinds[index];
+    lex->token_offset = stream->offsets[index];
+    lex->token_length = stream->lengths[index];
+    lex->loc = lex->source_base + stream->offsets[index];
+    switch(lex->token) {
+        case TOKEN_EOF:
+        case TOKEN_PARSING_ERROR:
+            return false;
+        case TOKEN_ID:
+            lex->string = lex->input_stream + lex->token_offset;
+            lex->string_length = lex->token_length;
+            lex->id = stream->payloads[index];
+            break;
+        case TOKEN_STRING_LIT:
+            lex->string = stream->strings.items[stream->payloads[index]].data;
+            lex->string_length = stream->strings.items[stream->payloads[index]].length;
+            break;
+        case TOKEN_INT_LIT:
+        case TOKEN_CHAR_LIT:
+            lex->int_number = stream->ints.items[stream->payloads[index]];
+            break;
+        case TOKEN_FLOAT_LIT:
+            lex->real_number = stream->reals.items[stream->payloads[index]];
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+static bool lexer_next_scanned_token(Lexer *lex)
+{
+    bool result = lexer_scan_token(lex);
+    lex->token_length = (size_t)(lex->parse_point.current - lex->input_stream) - lex->token_offset;
+    return result;
+}
+
+static bool lexer_take_token(Lexer *lex);
+
+bool lexer_get_token(Lexer *lex)
+{
+    // Counted here so every mode reports the same figure, whether the token
+    // is replayed, taken from a feed or scanned on demand
+    lex->served_tokens += 1;
+    if(lex->feed != NULL) return lexer_take_token(lex);
+    if(lex->stream != NULL) return lexer_replay_token(lex);
+    return lexer_next_scanned_token(lex);
+}
+
+// LOOKAHEAD
+//
+// Peeked tokens are lexed with lexer_get_token() like any other, then
+// moved out of the Lexer into the ring so the current token stays put.
+
+static void lexer_save_token(const Lexer *lex, LexedToken *saved, bool ok)
+{
+    saved->token = lex->token;
+    saved->ok = ok;
+    saved->string = lex->string;
+    saved->string_length = lex->string_length;
+    saved->id = lex->id;
+    saved->int_number = lex->int_number;
+    saved->real_number = lex->real_number;
+    saved->loc = lex->loc;
+    saved->token_offset = lex->token_offset;
+    saved->token_length = lex->token_length;
+}
+
+static bool lexer_load_token(Lexer *lex, const LexedToken *saved)
+{
+    lex->token = saved->token;
+    lex->string = saved->string;
+    lex->string_length = saved->string_length;
+    lex->id = saved->id;
+    lex->int_number = saved->int_number;
+    lex->real_number = saved->real_number;
+    lex->loc = saved->loc;
+    lex->token_offset = saved->token_offset;
+    lex->token_length = saved->token_length;
+    return saved->ok;
+}
+
+Token lexer_peek_token(Lexer *lex, size_t n)
+{
+    assert(n < LEXER_LOOKAHEAD && "Peeking further than LEXER_LOOKAHEAD");
+    if(n >= lex->lookahead_count) {
+        LexedToken current;
+        lexer_save_token(lex, &current, true);
+        while(lex->lookahead_count <= n) {
+            bool ok = lexer_get_token(lex);
+            size_t slot = (lex->lookahead_first + lex->lookahead_count) & (LEXER_LOOKAHEAD - 1);
+            lexer_save_token(lex, &lex->lookahead[slot], ok);
+            lex->lookahead_count += 1;
+        }
+        lexer_load_token(lex, &current);
+    }
+    return lex->lookahead[(lex->lookahead_first + n) & (LEXER_LOOKAHEAD - 1)].token;
+}
+
+bool lexer_advance(Lexer *lex)
+{
+    if(lex->lookahead_count == 0) return lexer_get_token(lex);
+    bool ok = lexer_load_token(lex, &lex->lookahead[lex->lookahead_first]);
+    lex->lookahead_first = (lex->lookahead_first + 1) & (LEXER_LOOKAHEAD - 1);
+    lex->lookahead_count -= 1;
+    return ok;
+}
+
+static void *lexer_grow(void *items, size_t item_size, size_t capacity)
+{
+    void *new_items = realloc(items, capacity * item_size);
+    assert(new_items != NULL && "Buy more RAM LOL!");
+    return new_items;
+}
+
+static uint32_t token_stream_push_int(TokenStream *stream, int64_t value)
+{
+    if(stream->ints.count + 1 > stream->ints.capacity) {
+        stream->ints.capacity = stream->ints.capacity == 0 ? 256 : stream->ints.capacity * 2;
+        stream->ints.items = lexer_grow(stream->ints.items, sizeof(*stream->ints.items), stream->ints.capacity);
+    }
+    stream->ints.items[stream->ints.count] = value;
+    return (uint32_t)stream->ints.count++;
+}
+
+static uint32_t token_stream_push_real(TokenStream *stream, double value)
+{
+    if(stream->reals.count + 1 > stream->reals.capacity) {
+        stream->reals.capacity = stream->reals.capacity == 0 ? 256 : stream->reals.capacity * 2;
+        stream->reals.items = lexer_grow(stream->reals.items, sizeof(*stream->reals.items), stream->reals.capacity);
+    }
+    stream->reals.items[stream->reals.count] = value;
+    return (uint32_t)stream->reals.count++;
+}
+
+static uint32_t token_stream_push_string(TokenStream *stream, char *data, size_t length)
+{
+    if(stream->strings.count + 1 > stream->strings.capacity) {
+        stream->strings.capacity = stream->strings.capacity == 0 ? 256 : stream->strings.capacity * 2;
+        stream->strings.items = lexer_grow(stream->strings.items, sizeof(*stream->strings.items), stream->strings.capacity);
+    }
+    stream->strings.items[stream->strings.count] = (TokenString) { .data = data, .length = length };
+    return (uint32_t)stream->strings.count++;
+}
+
+static void token_stream_reserve(TokenStream *stream, size_t count)
+{
+    static_assert(_COUNT_TOKENS <= 256, "Token kinds must fit in TokenStream.kinds");
+    if(stream->count + count <= stream->capacity) return;
+    if(stream->capacity == 0) stream->capacity = 1024;
+    while(stream->count + count > stream->capacity) stream->capacity *= 2;
+    stream->kinds    = lexer_grow(stream->kinds,    sizeof(*stream->kinds),    stream->capacity);
+    stream->offsets  = lexer_grow(stream->offsets,  sizeof(*stream->offsets),  stream->capacity);
+    stream->lengths  = lexer_grow(stream->lengths,  sizeof(*stream->lengths),  stream->capacity);
+    stream->payloads = lexer_grow(stream->payloads, sizeof(*stream->payloads), stream->capacity);
+}
+
+static void token_stream_push(TokenStream *stream, Lexer *lex)
+{
+    token_stream_reserve(stream, 1);
+
+    uint32_t payload = 0;
+    switch(lex->token) {
+        case TOKEN_ID:
+            payload = lex->id;
+            break;
+        case TOKEN_STRING_LIT:
+            payload = token_stream_push_string(stream, lex->string, lex->string_length);
+            break;
+        case TOKEN_INT_LIT:
+        case TOKEN_CHAR_LIT:
+            payload = token_stream_push_int(stream, lex->int_number);
+            break;
+        case TOKEN_FLOAT_LIT:
+            payload = token_stream_push_real(stream, lex->real_number);
+            break;
+        default:
+            break;
+    }
+
+    size_t i = stream->count++;
+    stream->kinds[i]    = (uint8_t)lex->token;
+    stream->offsets[i]  = (uint32_t)lex->token_offset;
+    stream->lengths[i]  = (uint32_t)lex->token_length;
+    stream->payloads[i] = payload;
+}
+
+bool lexer_tokenize(Lexer *lex, TokenStream *stream)
+{
+    assert(lex->lookahead_count == 0 && "Tokenizing would skip the peeked tokens");
+    lex->stream = NULL;
+    size_t first = stream->count;
+    while(lexer_next_scanned_token(lex)) {
+        token_stream_push(stream, lex);
+    }
+    // Keep the terminating EOF or parsing error so replaying reports it too
+    token_stream_push(stream, lex);
+
+    lex->stream = stream;
+    lex->parse_point.token_index = first;
+    return lex->token == TOKEN_EOF;
+}
+
+// PARALLEL
+//
+// The input is cut into chunks at guessed restart points and every chunk
+// is lexed by a speculative lexer on its own thread. A chunk is lexed for
+// tokens that start before the next chunk does, and records where the
+// first token past its end starts. The guess for the next chunk was right
+// exactly when its own first token starts at that same place: from a
+// token boundary on, lexing only depends on the position. Chunks that
+// guessed wrong or ran into an error are lexed again on the calling
+// thread, so diagnostics come out just like they do from lexer_tokenize().
+
+#define LEXER_PARALLEL_MIN_CHUNK (256*1024)
+
+typedef struct {
+    Lexer lex;
+    TokenStream stream;
+    char *begin;
+    char *end;
+    char *first;  // where the first token of the chunk starts
+    char *resume; // where the first token past the end starts
+    bool failed;  // ran into an error before the end
+    Thread thread;
+} LexerChunk;
+
+// Lexes the tokens that start before end into stream. The token at or
+// past end (or the EOF) is scanned but not pushed, resume points at it.
+static bool lexer_tokenize_chunk(Lexer *lex, TokenStream *stream, char *end, char **first, char **resume)
+{
+    bool ok = true;
+    bool at_first = true;
+    while(true) {
+        bool scanned = lexer_next_scanned_token(lex);
+        char *start = lex->input_stream + lex->token_offset;
+        if(at_first && first != NULL) *first = start;
+        at_first = false;
+        if(start >= end) break;
+        if(!scanned) {
+            ok = lex->token == TOKEN_EOF;
+            break;
+        }
+        token_stream_push(stream, lex);
+    }
+    *resume = lex->input_stream + lex->token_offset;
+    return ok;
+}
+
+static void lexer_chunk_run(void *data)
+{
+    LexerChunk *chunk = data;
+    chunk->failed = !lexer_tokenize_chunk(&chunk->lex, &chunk->stream, chunk->end, &chunk->first, &chunk->resume);
+}
+
+// Whether no string, character literal or block comment is left open at
+// the end of [begin, end). Only a heuristic for lexer_restart_point(),
+// since begin is not known to be outside of one either.
+static bool lexer_line_looks_closed(const char *begin, const char *end)
+{
+    char delim = 0;
+    bool comment = false;
+    for(const char *p = begin; p < end; ++p) {
+        if(comment) {
+            if(p[0] == '*' && p[1] == '/') {
+                comment = false;
+                p += 1;
+            }
+        } else if(delim != 0) {
+            if(*p == '\\') p += 1;
+            else if(*p == delim) delim = 0;
+        } else if(*p == '"' || *p == '\'') {
+            delim = *p;
+        } else if(p[0] == '/' && p[1] == '/') {
+            return true;
+        } else if(p[0] == '/' && p[1] == '*') {
+            comment = true;
+            p += 1;
+        }
+    }
+    return delim == 0 && !comment;
+}
+
+// Speculative pre-scan for a place to start a chunk at: right after a
+// newline that does not look like it is inside a literal or a comment
+static char *lexer_restart_point(char *guess, char *eof)
+{
+    for(int lines = 0; lines < 64 && guess < eof; ++lines) {
+        char *newline = (char*)scan_find_byte(guess, eof, '\n');
+        if(newline >= eof) return eof;
+        if(lexer_line_looks_closed(guess, newline)) return newline + 1;
+        guess = newline + 1;
+    }
+    return guess;
+}
+
+// Appends the tokens of a speculative chunk, interning its identifiers
+// and moving its decoded strings into the arena of lex
+static void lexer_stitch_chunk(Lexer *lex, TokenStream *stream, LexerChunk *chunk)
+{
+    TokenStream *part = &chunk->stream;
+    token_stream_reserve(stream, part->count);
+    for(size_t i = 0; i < part->count; ++i) {
+        uint32_t payload = part->payloads[i];
+        switch(part->kinds[i]) {
+            case TOKEN_ID:
+                payload = intern(lex->input_stream + part->offsets[i], part->lengths[i]);
+                break;
+            case TOKEN_STRING_LIT: {
+                TokenString string = part->strings.items[payload];
+                if(string.data < lex->input_stream || string.data >= lex->eof) {
+                    string.data = arena_memdup(&lex->arena, string.data, string.length + 1);
+                }
+                payload = token_stream_push_string(stream, string.data, string.length);
+            } break;
+            case TOKEN_INT_LIT:
+            case TOKEN_CHAR_LIT:
+                payload = token_stream_push_int(stream, part->ints.items[payload]);
+                break;
+            case TOKEN_FLOAT_LIT:
+                payload = token_stream_push_real(stream, part->reals.items[payload]);
+                break;
+            default:
+                break;
+        }
+        size_t j = stream->count++;
+        stream->kinds[j]    = part->kinds[i];
+        stream->offsets[j]  = part->offsets[i];
+        stream->lengths[j]  = part->lengths[i];
+        stream->payloads[j] = payload;
+    }
+    lex->scanned_tokens += chunk->lex.scanned_tokens;
+}
+
+bool lexer_tokenize_parallel(Lexer *lex, TokenStream *stream, size_t threads)
+{
+    assert(lex->lookahead_count == 0 && "Tokenizing would skip the peeked tokens");
+    char *begin = lex->parse_point.current;
+    size_t size = (size_t)(lex->eof - begin);
+    size_t count = size / LEXER_PARALLEL_MIN_CHUNK;
+    if(count > threads) count = threads;
+    if(count <= 1 || lex->stream != NULL) return lexer_tokenize(lex, stream);
+    // The workers share the token set of lex
+    if(lex->token_set == NULL) lexer_compile_token_set(lex);
+
+    LexerChunk *chunks = calloc(count, sizeof(*chunks));
+    assert(chunks != NULL && "Buy more RAM LOL!");
+    for(size_t i = 0; i < count; ++i) {
+        LexerChunk *chunk = &chunks[i];
+        chunk->begin = i == 0 ? begin : lexer_restart_point(begin + size * i / count, lex->eof);
+        if(i > 0 && chunk->begin < chunks[i - 1].begin) chunk->begin = chunks[i - 1].begin;
+        chunk->lex = *lex;
+        chunk->lex.arena = (Arena){0};
+        chunk->lex.speculative = true;
+        chunk->lex.scanned_tokens = 0;
+        chunk->lex.parse_point.current = chunk->begin;
+    }
+    for(size_t i = 0; i < count; ++i) {
+        chunks[i].end = i + 1 < count ? chunks[i + 1].begin : lex->eof;
+    }
+
+    // The calling thread takes the first chunk
+    for(size_t i = 1; i < count; ++i) thread_start(&chunks[i].thread, lexer_chunk_run, &chunks[i]);
+    lexer_chunk_run(&chunks[0]);
+    for(size_t i = 1; i < count; ++i) thread_join(&chunks[i].thread);
+
+    size_t first = stream->count;
+    char *resume = begin;
+    bool ok = true;
+    for(size_t i = 0; i < count && ok; ++i) {
+        LexerChunk *chunk = &chunks[i];
+        if(chunk->failed || (i > 0 && chunk->first != resume)) {
+            lex->parse_point.current = resume;
+            ok = lexer_tokenize_chunk(lex, stream, chunk->end, NULL, &resume);
+        } else {
+            lexer_stitch_chunk(lex, stream, chunk);
+            resume = chunk->resume;
+        }
+    }
+    if(ok) {
+        // Normally only the EOF is left
+        lex->parse_point.current = resume;
+        while(lexer_next_scanned_token(lex)) token_stream_push(stream, lex);
+    }
+    token_stream_push(stream, lex);
+
+    for(size_t i = 0; i < count; ++i) {
+        token_stream_free(&chunks[i].stream);
+        arena_free(&chunks[i].lex.arena);
+    }
+    free(chunks);
+
+    lex->stream = stream;
+    lex->parse_point.token_index = first;
+    return lex->token == TOKEN_EOF;
+}
+
+// INCREMENTAL
+//
+// Tokens that end well before an edit were scanned without looking at the
+// edited bytes, so they are kept and lexing restarts right after the last
+// of them. Past the edit the old and the new input are the same bytes, and
+// from a token boundary on lexing only depends on what follows (see
+// PARALLEL): once a new token starts where an old one did, every old token
+// from there on is still right and only moves by the size difference.
+
+// How many bytes past its end the scanner may read to tell where a token
+// ends: `1e+` is only a float literal when a digit follows, and `<` has
+// to rule out the longer punctuations starting with it
+static size_t lexer_read_ahead(const TokenSet *set)
+{
+    size_t read_ahead = 3;
+    if(set->longest_punct > read_ahead + 1) read_ahead = set->longest_punct - 1;
+    return read_ahead;
+}
+
+bool lexer_relex(Lexer *lex, TokenStream *stream, char *input_stream, char *eof, TextEdit edit)
+{
+    assert(*eof == '\0' && "Input must be followed by a NUL sentinel");
+    assert(lex->stream == stream && stream->count > 0 && "The stream must be the one lex was tokenized into");
+    assert(edit.begin <= edit.end && edit.end <= (size_t)(lex->eof - lex->input_stream));
+    assert(edit.begin + edit.length <= (size_t)(eof - input_stream));
+    if(lex->token_set == NULL) lexer_compile_token_set(lex);
+
+    char *old_input = lex->input_stream;
+    char *old_eof = lex->eof;
+    size_t removed = edit.end - edit.begin;
+    // Old offsets past the edit move by length - removed, modulo 2^32
+    uint32_t shift = (uint32_t)edit.length - (uint32_t)removed;
+
+    // First token that may have read into the edit, the tokens are sorted
+    size_t read_ahead = lexer_read_ahead(lex->token_set);
+    size_t lo = 0, hi = stream->count - 1;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if((size_t)stream->offsets[mid] + stream->lengths[mid] + read_ahead <= edit.begin) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t restart = lo;
+    size_t start = restart == 0 ? 0 : (size_t)stream->offsets[restart - 1] + stream->lengths[restart - 1];
+
+    // Unescaped string literals are views into the input
+    for(size_t i = 0; i < stream->strings.count; ++i) {
+        TokenString *string = &stream->strings.items[i];
+        if(string->data < old_input || string->data > old_eof) continue;
+        size_t offset = (size_t)(string->data - old_input);
+        if(offset >= edit.end) string->data = input_stream + offset + edit.length - removed;
+        else if(offset < edit.begin) string->data = input_stream + offset;
+        else string->data = input_stream + edit.begin; // the token is about to be replaced
+    }
+
+    lex->input_stream = input_stream;
+    lex->eof = eof;
+    lex->source_base = source_update(lex->source_base, input_stream, eof);
+    lex->lookahead_count = 0;
+    lex->stream = NULL;
+    lex->parse_point.current = input_stream + start;
+
+    // The payloads of the new tokens go straight to the side arrays of
+    // stream. The ones of the replaced tokens stay there unused until the
+    // input is tokenized from scratch.
+    TokenStream fresh = {0};
+    fresh.ints = stream->ints;
+    fresh.reals = stream->reals;
+    fresh.strings = stream->strings;
+    size_t resync = stream->count;
+    size_t old = restart;
+    while(true) {
+        bool scanned = lexer_next_scanned_token(lex);
+        if(lex->token_offset >= edit.begin + edit.length) {
+            uint32_t old_offset = (uint32_t)lex->token_offset - shift;
+            while(old < stream->count && stream->offsets[old] < old_offset) old += 1;
+            if(old < stream->count && stream->offsets[old] == old_offset) {
+                resync = old;
+                break;
+            }
+        }
+        token_stream_push(&fresh, lex);
+        if(!scanned) break;
+    }
+    stream->ints = fresh.ints;
+    stream->reals = fresh.reals;
+    stream->strings = fresh.strings;
+
+    // tokens[0, restart) + fresh + tokens[resync, count) shifted
+    size_t tail = stream->count - resync;
+    size_t count = restart + fresh.count + tail;
+    if(count > stream->count) token_stream_reserve(stream, count - stream->count);
+    size_t to = restart + fresh.count;
+    memmove(stream->kinds    + to, stream->kinds    + resync, tail * sizeof(*stream->kinds));
+    memmove(stream->offsets  + to, stream->offsets  + resync, tail * sizeof(*stream->offsets));
+    memmove(stream->lengths  + to, stream->lengths  + resync, tail * sizeof(*stream->lengths));
+    memmove(stream->payloads + to, stream->payloads + resync, tail * sizeof(*stream->payloads));
+    for(size_t i = to; i < count; ++i) stream->offsets[i] += shift;
+    if(fresh.count > 0) {
+        memcpy(stream->kinds    + restart, fresh.kinds,    fresh.count * sizeof(*stream->kinds));
+        memcpy(stream->offsets  + restart, fresh.offsets,  fresh.count * sizeof(*stream->offsets));
+        memcpy(stream->lengths  + restart, fresh.lengths,  fresh.count * sizeof(*stream->lengths));
+        memcpy(stream->payloads + restart, fresh.payloads, fresh.count * sizeof(*stream->payloads));
+    }
+    stream->count = count;
+    free(fresh.kinds);
+    free(fresh.offsets);
+    free(fresh.lengths);
+    free(fresh.payloads);
+
+    lex->stream = stream;
+    lex->parse_point.token_index = 0;
+    return stream->kinds[stream->count - 1] == TOKEN_EOF;
+}
+
+// PIPELINE
+//
+// The feeding lexer is speculative like the chunks of PARALLEL. When it
+// stops at an error, the lexer taking its tokens scans that token once
+// more from the input, so the diagnostic comes out of the parsing thread
+// and in order with the ones of the parser.
+
+struct LexerFeed {
+    Lexer lex;
+    SpscQueue queue;
+    Thread thread;
+};
+
+static void lexer_feed_run(void *data)
+{
+    LexerFeed *feed = data;
+    while(true) {
+        LexedToken token;
+        bool ok = lexer_next_scanned_token(&feed->lex);
+        lexer_save_token(&feed->lex, &token, ok);
+        if(!spsc_push(&feed->queue, &token) || !ok) break;
+    }
+    spsc_close(&feed->queue);
+}
+
+LexerFeed *lexer_feed_start(Lexer *lex, size_t capacity)
+{
+    assert(lex->lookahead_count == 0 && "Feeding would skip the peeked tokens");
+    assert(lex->stream == NULL && lex->feed == NULL);
+    // The feeding lexer shares the token set of lex
+    if(lex->token_set == NULL) lexer_compile_token_set(lex);
+    LexerFeed *feed = calloc(1, sizeof(*feed));
+    assert(feed != NULL && "Buy more RAM LOL!");
+    feed->lex = *lex;
+    feed->lex.arena = (Arena){0};
+    feed->lex.speculative = true;
+    feed->lex.scanned_tokens = 0;
+    spsc_init(&feed->queue, sizeof(LexedToken), capacity);
+    lex->feed = feed;
+    thread_start(&feed->thread, lexer_feed_run, feed);
+    return feed;
+}
+
+static bool lexer_take_token(Lexer *lex)
+{
+    LexedToken token;
+    bool taken = spsc_pop(&lex->feed->queue, &token);
+    assert(taken && "The feed ends with the token it stopped at");
+    (void)taken;
+    if(!lexer_load_token(lex, &token)) {
+        // Scanning on from the input keeps returning the EOF or the error
+        lex->feed = NULL;
+        lex->parse_point.current = lex->input_stream + token.token_offset;
+        return lexer_next_scanned_token(lex);
+    }
+    if(lex->token == TOKEN_ID) lex->id = intern(lex->string, lex->string_length);
+    return true;
+}
+
+void lexer_feed_stop(Lexer *lex, LexerFeed *feed)
+{
+    spsc_cancel(&feed->queue);
+    thread_join(&feed->thread);
+    if(lex->feed == feed) lex->feed = NULL;
+    lex->scanned_tokens += feed->lex.scanned_tokens;
+    spsc_free(&feed->queue);
+    arena_free(&feed->lex.arena);
+    free(feed);
+}
+
+void token_stream_free(TokenStream *stream)
+{
+    free(stream->kinds);
+    free(stream->offsets);
+    free(stream->lengths);
+    free(stream->payloads);
+    free(stream->ints.items);
+    free(stream->reals.items);
+    free(stream->strings.items);
+    *stream = (TokenStream){0};
+}
+
+void lexer_destroy(Lexer *lex)
+{
+    arena_free(&lex->arena);
+}
+
 bool lexer_expect_token(Lexer *lex, Token token)
 {
     if(lex->token == token) return true;
-    compiler_diagf(lex->loc, "ERROR: expected %s, but got %s", lexer_display_token(token), lexer_display_token(lex->token));
+    compiler_diagf(lex->loc, "ERROR: expected %s, but got %s", lexer_display_token_of(lex, token), lexer_display_token_of(lex, lex->token));
     return false;
 }
 
@@ -419,14 +1493,14 @@ Token lexer_expect_token2(Lexer *lex, Token token_1, Token token_2)
 {
     if(lex->token == token_1 || lex->token == token_2) return lex->token;
     compiler_diagf(lex->loc, "ERROR: expected %s or %s, but got %s", 
-            lexer_display_token(token_1), 
-            lexer_display_token(token_2), 
-            lexer_display_token(lex->token));
+            lexer_display_token_of(lex, token_1), 
+            lexer_display_token_of(lex, token_2), 
+            lexer_display_token_of(lex, lex->token));
     return TOKEN_PARSING_ERROR;
 }
 
 bool lexer_get_and_expect_token(Lexer *lex, Token token)
 {
-    if(!lexer_get_token(lex) && lex->token != TOKEN_EOF) return false;
+    if(!lexer_advance(lex) && lex->token != TOKEN_EOF) return false;
     return lexer_expect_token(lex, token);
 }
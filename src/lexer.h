@@ -34,27 +34,40 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "arena.h"
 
 #ifndef ARRAY_LEN
 #define ARRAY_LEN(xs) (sizeof(xs)/sizeof(*(xs)))
 #endif
 
+// A byte offset into the inputs registered with source_register(). Line
+// and column are only worked out by loc_info() when a diagnostic needs
+// them. 0 is never a valid location.
+typedef uint32_t Loc;
+
 typedef struct {
     char *input_path;
     int line_offset;
     int line_number;
-} Loc;
+} LocInfo;
 
-#define HERE() (Loc){ __FILE__, -1, __LINE__ }
+Loc source_register(char *input_path, char *input_stream, char *eof);
+// Points the source registered at base to an edited copy of its input.
+// Returns its new base, which stays the same unless the input outgrew the
+// range of locations it had.
+Loc source_update(Loc base, char *input_stream, char *eof);
+LocInfo loc_info(Loc loc);
 
 #define compiler_missingf(loc, ...) _compiler_missingf(__FILE__, __LINE__, loc, __VA_ARGS__)
 void _compiler_missingf(const char *file, int line, Loc loc, const char *fmt, ...);
 void compiler_diagf(Loc loc, const char *fmt, ...);
+// Drops the diagnostics of the calling thread while muted, for work that
+// is done again on failure to report it
+void compiler_mute_diags(bool muted);
 
-// TODO: instead of registering tokens like this maybe 
-//       having the user to register the tokens would be 
-//       then I can use the lexer for multiple programming
-//       language.
+// Builtin tokens of bulan; other languages register theirs with
+// lexer_register_punct() and lexer_register_keyword() (see below).
 #define PUNCT_TOKEN_LIST    \
     X(QUESTION     , "?"  ) \
     X(OCURLY       , "{"  ) \
@@ -105,7 +118,7 @@ void compiler_diagf(Loc loc, const char *fmt, ...);
     X(SWITCH       , "switch"    ) \
     X(GOTO         , "goto"      ) \
     X(RETURN       , "return"    ) \
-    X(FN           , "fn"        ) \
+    X(FUNCTION     , "function"  ) \
     X(LET          , "let"       ) \
 
 typedef enum {
@@ -126,52 +139,193 @@ typedef enum {
     // Keywords 
     KEYWORD_TOKEN_LIST
 #undef X
+
+    _COUNT_TOKENS,
 } Token;
 
 typedef struct {
     char *current;
-    char *line_start;
-    size_t line_number;
+    // Only meaningful when the lexer replays a TokenStream
+    size_t token_index;
 } ParsePoint;
 
+// Text of an identifier or string literal. Points into the input stream
+// unless it is a string literal with escape sequences, those are decoded
+// once into the lexer's arena.
+typedef struct {
+    char *data;
+    size_t length;
+} TokenString;
+
+// Every token of an input lexed once by lexer_tokenize(), stored as
+// parallel arrays. A lexer attached to a stream replays it from
+// parse_point.token_index.
+typedef struct {
+    uint8_t  *kinds;
+    uint32_t *offsets;      // byte offset of the token in the input stream
+    uint32_t *lengths;      // byte length of the token in the input stream
+    uint32_t *payloads;     // interned id, or index into ints, reals or strings, depending on the kind
+    size_t count;
+    size_t capacity;
+
+    struct {
+        int64_t *items;
+        size_t count;
+        size_t capacity;
+    } ints;
+
+    struct {
+        double *items;
+        size_t count;
+        size_t capacity;
+    } reals;
+
+    // String literals, identifiers are read straight from the input
+    struct {
+        TokenString *items;
+        size_t count;
+        size_t capacity;
+    } strings;
+} TokenStream;
+
+// A token registered with lexer_register_punct() or lexer_register_keyword()
 typedef struct {
     int token;
     const char *literal;
     bool is_keyword;
+    const char *display; // how diagnostics name it
 } TokenInfo;
 
+// Punctuations and keywords compiled into lookup tables, see lexer.c
+typedef struct TokenSet TokenSet;
+
+// How far lexer_peek_token() can look ahead, a power of two
+#define LEXER_LOOKAHEAD 4
+
+// Everything lexer_get_token() sets about a token, kept for the ones
+// lexer_peek_token() lexed ahead of the current one
+typedef struct {
+    Token token;
+    bool ok; // what lexer_get_token() returned for it
+    char *string;
+    size_t string_length;
+    uint32_t id;
+    int64_t int_number;
+    double real_number;
+    Loc loc;
+    size_t token_offset;
+    size_t token_length;
+} LexedToken;
+
+// See lexer_feed_start()
+typedef struct LexerFeed LexerFeed;
+
 typedef struct {
     char *input_path;
     char *input_stream;
     char *eof;
+    Loc source_base;
     ParsePoint parse_point;
-    struct {
-        char *items;
-        size_t count;
-        size_t capacity;
-    } string_storage;
+    Arena arena;
     Token token;
+    // Not NUL-terminated, see TokenString
     char *string;
+    size_t string_length;
+    uint32_t id; // interned identifier, see intern.h
     int64_t int_number;
     double real_number;
     Loc loc;
+    size_t token_offset;
+    size_t token_length;
+
+    TokenStream *stream;
+    // Tokens scanned ahead on another thread, see lexer_feed_start()
+    LexerFeed *feed;
+    // Set on the worker lexers of lexer_tokenize_parallel(): no diagnostics
+    // and identifiers are not interned, id stays 0
+    bool speculative;
+    size_t scanned_tokens;
+    size_t served_tokens;
 
+    // The built-in set, unless tokens were registered. NULL until the
+    // registered ones are compiled.
+    const TokenSet *token_set;
     TokenInfo tokens[128];
     size_t count_tokens;
+
+    // Ring of tokens peeked but not advanced to yet
+    LexedToken lookahead[LEXER_LOOKAHEAD];
+    size_t lookahead_first;
+    size_t lookahead_count;
 } Lexer;
 
+// *eof must be a readable '\0' (see SourceFile), the hot loops stop on
+// that sentinel rather than checking the cursor against eof
 Lexer lexer_new(char *input_path, char *input_stream, char *eof);
+// Starts lex over on another version of its input, keeping its source
+// registered rather than adding one. Decoded strings of the tokens lexed so
+// far are dropped.
+void lexer_reset(Lexer *lex, char *input_stream, char *eof);
 void lexer_destroy(Lexer *lex);
+// Builds the tables every lexer shares, which the first lexer_new() does
+// otherwise. A process that forks lexers off calls it once beforehand so
+// they all start with the tables built.
+void lexer_build_tables(void);
+// Lexes the next token straight from the input or the stream, ignoring
+// anything lexer_peek_token() has buffered. Parsers want lexer_advance().
 bool lexer_get_token(Lexer *lex);
+// Makes the next token the current one, taking it from the lookahead ring
+// when it was peeked. Returns false on EOF or a parsing error.
+bool lexer_advance(Lexer *lex);
+// Kind of the n-th token after the current one (0 is the next), without
+// advancing. n must be below LEXER_LOOKAHEAD.
+Token lexer_peek_token(Lexer *lex, size_t n);
+// Lexes the rest of the input into stream and attaches the lexer to it
+bool lexer_tokenize(Lexer *lex, TokenStream *stream);
+// Same result as lexer_tokenize(), but large inputs are split into chunks
+// lexed on up to `threads` threads. The string interner is only touched
+// from the calling thread.
+bool lexer_tokenize_parallel(Lexer *lex, TokenStream *stream, size_t threads);
+void token_stream_free(TokenStream *stream);
+// Pipelined lexing: a speculative copy of lex scans the rest of the input
+// on its own thread, up to `capacity` tokens (a power of two) ahead, and
+// lex takes its tokens from there on. Identifiers are interned and errors
+// reported by the thread taking the tokens. Their decoded strings live
+// until lexer_feed_stop(), which stops the copy wherever it got to.
+LexerFeed *lexer_feed_start(Lexer *lex, size_t capacity);
+void lexer_feed_stop(Lexer *lex, LexerFeed *feed);
+
+// The bytes [begin, end) of an input replaced by `length` bytes
+typedef struct {
+    size_t begin;
+    size_t end;
+    size_t length;
+} TextEdit;
+
+// Brings stream, which lex was tokenized into, up to date with an edit of
+// its input. input_stream..eof is the edited input, the replacement sits
+// at edit.begin. Only the tokens around the edit are lexed again, the ones
+// after it are shifted. Leaves lex attached at the start of the stream and
+// returns like lexer_tokenize().
+bool lexer_relex(Lexer *lex, TokenStream *stream, char *input_stream, char *eof, TextEdit edit);
 bool lexer_expect_token(Lexer *lex, Token token);
 Token lexer_expect_token2(Lexer *lex, Token token_1, Token token_2);
 bool lexer_get_and_expect_token(Lexer *lex, Token token);
 const char *lexer_display_token(Token token);
+// Returns the built-in keyword token spelled by text[0..length), or TOKEN_ID
+Token lexer_keyword_token(const char *text, size_t length);
 Loc lexer_loc(Lexer *lex);
 
-// TODO: let user register their own tokens
-// void lexer_register_punct(Lexer *lex, const char *punct, int token);
-// void lexer_register_keyword(Lexer *lex, const char *keyword, int token);
-// void lexer_register_default_tokens(Lexer *lex); // C tokens
+// Lets a lexer recognize another language. Once anything is registered
+// the lexer only knows the registered punctuations and keywords, call
+// lexer_register_builtin_tokens() first to extend bulan instead. `token` is
+// any value past TOKEN_FLOAT_LIT that fits in a byte, either a built-in
+// one or the embedder's own starting at _COUNT_TOKENS. Returns false for
+// a literal that can not be such a token, a duplicate, or a full set.
+bool lexer_register_punct(Lexer *lex, int token, const char *literal);
+bool lexer_register_keyword(Lexer *lex, int token, const char *literal);
+void lexer_register_builtin_tokens(Lexer *lex);
+// Like lexer_display_token() but knows the tokens registered on lex
+const char *lexer_display_token_of(Lexer *lex, Token token);
 
 #endif // LEXER_H_
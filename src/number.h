@@ -0,0 +1,20 @@
+#ifndef NUMBER_H_
+#define NUMBER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Conversions behind number literals. The lexer checks the syntax, these
+// only see well formed text in [begin, end) and report whether the value
+// fits. Floats are correctly rounded (round to nearest, ties to even).
+
+// [0-9]+
+bool number_decimal_to_u64(const char *begin, const char *end, uint64_t *value);
+// [0-9a-fA-F]+, without the 0x prefix
+bool number_hex_to_u64(const char *begin, const char *end, uint64_t *value);
+// [0-9]+ ('.' [0-9]+)? ([eE] [+-]? [0-9]+)?
+bool number_decimal_to_double(const char *begin, const char *end, double *value);
+// [0-9a-fA-F]* ('.' [0-9a-fA-F]*)? [pP] [+-]? [0-9]+, without the 0x prefix
+bool number_hex_to_double(const char *begin, const char *end, double *value);
+
+#endif // NUMBER_H_
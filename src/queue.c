@@ -0,0 +1,66 @@
+#include "queue.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+
+void spsc_init(SpscQueue *queue, size_t item_size, size_t capacity)
+{
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0 && "Capacity must be a power of two");
+    queue->items = malloc(item_size * capacity);
+    assert(queue->items != NULL && "Buy more RAM LOL!");
+    queue->item_size = item_size;
+    queue->capacity = capacity;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->closed, false);
+    atomic_init(&queue->cancelled, false);
+}
+
+void spsc_free(SpscQueue *queue)
+{
+    free(queue->items);
+    queue->items = NULL;
+}
+
+bool spsc_push(SpscQueue *queue, const void *item)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    while(tail - atomic_load_explicit(&queue->head, memory_order_acquire) == queue->capacity) {
+        if(atomic_load_explicit(&queue->cancelled, memory_order_acquire)) return false;
+        thread_yield();
+    }
+    if(atomic_load_explicit(&queue->cancelled, memory_order_acquire)) return false;
+    memcpy(queue->items + (tail & (queue->capacity - 1)) * queue->item_size, item, queue->item_size);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_pop(SpscQueue *queue, void *item)
+{
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    while(true) {
+        if(atomic_load_explicit(&queue->cancelled, memory_order_acquire)) return false;
+        if(atomic_load_explicit(&queue->tail, memory_order_acquire) != head) break;
+        // Closing comes after the last push, so a queue seen closed and
+        // then still empty is drained for good
+        if(atomic_load_explicit(&queue->closed, memory_order_acquire)) {
+            if(atomic_load_explicit(&queue->tail, memory_order_acquire) != head) break;
+            return false;
+        }
+        thread_yield();
+    }
+    memcpy(item, queue->items + (head & (queue->capacity - 1)) * queue->item_size, queue->item_size);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+void spsc_close(SpscQueue *queue)
+{
+    atomic_store_explicit(&queue->closed, true, memory_order_release);
+}
+
+void spsc_cancel(SpscQueue *queue)
+{
+    atomic_store_explicit(&queue->cancelled, true, memory_order_release);
+}
@@ -0,0 +1,37 @@
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bounded ring of fixed size items between exactly one producer thread
+// and one consumer thread. No locks: each side only writes its own index
+// and publishes it with release, the other side reads it with acquire.
+// A full queue makes the producer wait and an empty one the consumer.
+
+typedef struct {
+    char *items;
+    size_t item_size;
+    size_t capacity; // a power of two
+
+    // Counted up forever, wrapped by capacity. Kept on their own cache
+    // lines so the two sides do not fight over one.
+    _Alignas(64) atomic_size_t head; // next to pop, written by the consumer
+    _Alignas(64) atomic_size_t tail; // next to push, written by the producer
+    _Alignas(64) atomic_bool closed;    // the producer is done
+    atomic_bool cancelled; // either side gave up, nothing more goes through
+} SpscQueue;
+
+void spsc_init(SpscQueue *queue, size_t item_size, size_t capacity);
+void spsc_free(SpscQueue *queue);
+// Copies item in, waits while the queue is full. Returns false, without
+// pushing, once the queue is cancelled.
+bool spsc_push(SpscQueue *queue, const void *item);
+// Copies the oldest item out, waits while the queue is empty. Returns
+// false once the queue is closed and drained, or cancelled.
+bool spsc_pop(SpscQueue *queue, void *item);
+void spsc_close(SpscQueue *queue);
+void spsc_cancel(SpscQueue *queue);
+
+#endif // QUEUE_H_
@@ -0,0 +1,448 @@
+#include "scan.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "char_class.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SCAN_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SCAN_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define SCAN_X86_64 0
+#endif
+
+static inline int scan_ctz32(uint32_t x)
+{
+    assert(x != 0);
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+static inline int scan_clz32(uint32_t x)
+{
+    assert(x != 0);
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return 31 - (int)index;
+#else
+    return __builtin_clz(x);
+#endif
+}
+
+static inline int scan_ctz64(uint64_t x)
+{
+    assert(x != 0);
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// POPCNT is not part of baseline x86-64, so count bits by hand
+static inline size_t scan_popcount32(uint32_t x)
+{
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    x = (x + (x >> 4)) & 0x0F0F0F0Fu;
+    return (size_t)((x * 0x01010101u) >> 24);
+}
+
+static inline bool scan_is_space(char ch)
+{
+    return char_is(ch, CHAR_SPACE);
+}
+
+// SCALAR
+
+static const char *scan_skip_whitespace_scalar(const char *begin, const char *end)
+{
+    while(begin < end && scan_is_space(*begin)) begin += 1;
+    return begin;
+}
+
+static const char *scan_find_byte_scalar(const char *begin, const char *end, char ch)
+{
+    while(begin < end && *begin != ch) begin += 1;
+    return begin;
+}
+
+static const char *scan_find_comment_end_scalar(const char *begin, const char *end)
+{
+    for(; begin + 1 < end; begin += 1) {
+        if(begin[0] == '*' && begin[1] == '/') return begin;
+    }
+    return end;
+}
+
+static size_t scan_count_newlines_scalar(const char *begin, const char *end, const char **line_start)
+{
+    size_t count = 0;
+    for(; begin < end; begin += 1) {
+        if(*begin == '\n') {
+            count += 1;
+            *line_start = begin + 1;
+        }
+    }
+    return count;
+}
+
+#if SCAN_X86_64
+
+// SSE2
+
+// ' ' or '\t'..'\r', the latter checked as (x - '\t') <= 4 unsigned
+static inline __m128i scan_space_mask_sse2(__m128i x)
+{
+    __m128i space = _mm_cmpeq_epi8(x, _mm_set1_epi8(' '));
+    __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+    return _mm_or_si128(space, control);
+}
+
+static const char *scan_skip_whitespace_sse2(const char *begin, const char *end)
+{
+    while(end - begin >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)begin);
+        uint32_t other = ~(uint32_t)_mm_movemask_epi8(scan_space_mask_sse2(x)) & 0xFFFF;
+        if(other != 0) return begin + scan_ctz32(other);
+        begin += 16;
+    }
+    return scan_skip_whitespace_scalar(begin, end);
+}
+
+static const char *scan_find_byte_sse2(const char *begin, const char *end, char ch)
+{
+    __m128i needle = _mm_set1_epi8(ch);
+    while(end - begin >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)begin);
+        uint32_t found = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, needle));
+        if(found != 0) return begin + scan_ctz32(found);
+        begin += 16;
+    }
+    return scan_find_byte_scalar(begin, end, ch);
+}
+
+static const char *scan_find_comment_end_sse2(const char *begin, const char *end)
+{
+    __m128i star  = _mm_set1_epi8('*');
+    __m128i slash = _mm_set1_epi8('/');
+    // The second load reads one byte ahead
+    while(end - begin >= 17) {
+        __m128i x = _mm_loadu_si128((const __m128i*)begin);
+        __m128i y = _mm_loadu_si128((const __m128i*)(begin + 1));
+        uint32_t found = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, star), _mm_cmpeq_epi8(y, slash)));
+        if(found != 0) return begin + scan_ctz32(found);
+        begin += 16;
+    }
+    return scan_find_comment_end_scalar(begin, end);
+}
+
+static size_t scan_count_newlines_sse2(const char *begin, const char *end, const char **line_start)
+{
+    __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    while(end - begin >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)begin);
+        uint32_t found = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, newline));
+        if(found != 0) {
+            count += scan_popcount32(found);
+            *line_start = begin + (31 - scan_clz32(found)) + 1;
+        }
+        begin += 16;
+    }
+    return count + scan_count_newlines_scalar(begin, end, line_start);
+}
+
+// AVX2
+//
+// The tails are handled inline: GCC turns a call into the SSE2 version
+// into a tail jump without vzeroupper, which makes any SSE code that runs
+// after it pay for the dirty upper halves of the YMM registers.
+
+SCAN_TARGET_AVX2
+static inline __m256i scan_space_mask_avx2(__m256i x)
+{
+    __m256i space = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' '));
+    __m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+    __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted);
+    return _mm256_or_si256(space, control);
+}
+
+SCAN_TARGET_AVX2
+static const char *scan_skip_whitespace_avx2(const char *begin, const char *end)
+{
+    // Most runs are a single space or an indentation, settle those with
+    // one 16 byte step before paying for the 32 byte setup
+    if(end - begin >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)begin);
+        uint32_t other = ~(uint32_t)_mm_movemask_epi8(scan_space_mask_sse2(x)) & 0xFFFF;
+        if(other != 0) return begin + scan_ctz32(other);
+        begin += 16;
+    }
+    while(end - begin >= 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)begin);
+        uint32_t other = ~(uint32_t)_mm256_movemask_epi8(scan_space_mask_avx2(x));
+        if(other != 0) return begin + scan_ctz32(other);
+        begin += 32;
+    }
+    while(begin < end && scan_is_space(*begin)) begin += 1;
+    return begin;
+}
+
+SCAN_TARGET_AVX2
+static const char *scan_find_byte_avx2(const char *begin, const char *end, char ch)
+{
+    __m256i needle = _mm256_set1_epi8(ch);
+    while(end - begin >= 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)begin);
+        uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle));
+        if(found != 0) return begin + scan_ctz32(found);
+        begin += 32;
+    }
+    while(begin < end && *begin != ch) begin += 1;
+    return begin;
+}
+
+SCAN_TARGET_AVX2
+static const char *scan_find_comment_end_avx2(const char *begin, const char *end)
+{
+    __m256i star  = _mm256_set1_epi8('*');
+    __m256i slash = _mm256_set1_epi8('/');
+    while(end - begin >= 33) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)begin);
+        __m256i y = _mm256_loadu_si256((const __m256i*)(begin + 1));
+        uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x, star), _mm256_cmpeq_epi8(y, slash)));
+        if(found != 0) return begin + scan_ctz32(found);
+        begin += 32;
+    }
+    for(; begin + 1 < end; begin += 1) {
+        if(begin[0] == '*' && begin[1] == '/') return begin;
+    }
+    return end;
+}
+
+SCAN_TARGET_AVX2
+static size_t scan_count_newlines_avx2(const char *begin, const char *end, const char **line_start)
+{
+    __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    if(end - begin < 32) return scan_count_newlines_sse2(begin, end, line_start);
+    while(end - begin >= 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)begin);
+        uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, newline));
+        if(found != 0) {
+            count += scan_popcount32(found);
+            *line_start = begin + (31 - scan_clz32(found)) + 1;
+        }
+        begin += 32;
+    }
+    for(; begin < end; begin += 1) {
+        if(*begin == '\n') {
+            count += 1;
+            *line_start = begin + 1;
+        }
+    }
+    return count;
+}
+
+static bool scan_cpu_has_avx2(void)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 7) return false;
+    __cpuid(info, 1);
+    // AVX and OSXSAVE, then ask the OS whether it saves the YMM registers
+    if((info[2] & (1 << 28)) == 0 || (info[2] & (1 << 27)) == 0) return false;
+    if((_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    if((ecx & bit_AVX) == 0 || (ecx & bit_OSXSAVE) == 0) return false;
+    unsigned int xcr0, xcr0_high;
+    __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+    (void)xcr0_high;
+    if((xcr0 & 6) != 6) return false;
+    if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+    return (ebx & bit_AVX2) != 0;
+#endif
+}
+
+#endif // SCAN_X86_64
+
+// DISPATCH
+
+typedef struct {
+    const char *(*skip_whitespace)(const char *begin, const char *end);
+    const char *(*find_byte)(const char *begin, const char *end, char ch);
+    const char *(*find_comment_end)(const char *begin, const char *end);
+    size_t (*count_newlines)(const char *begin, const char *end, const char **line_start);
+} ScanKernels;
+
+static ScanKernels scan_kernels = {0};
+
+ScanLevel scan_select(ScanLevel max_level)
+{
+    ScanLevel level = SCAN_SCALAR;
+#if SCAN_X86_64
+    // SSE2 is part of baseline x86-64
+    level = SCAN_SSE2;
+    if(max_level >= SCAN_AVX2 && scan_cpu_has_avx2()) level = SCAN_AVX2;
+#endif
+    if(level > max_level) level = max_level;
+
+    switch(level) {
+#if SCAN_X86_64
+        case SCAN_AVX2:
+            scan_kernels = (ScanKernels) {
+                .skip_whitespace  = scan_skip_whitespace_avx2,
+                .find_byte        = scan_find_byte_avx2,
+                .find_comment_end = scan_find_comment_end_avx2,
+                .count_newlines   = scan_count_newlines_avx2,
+            };
+            break;
+        case SCAN_SSE2:
+            scan_kernels = (ScanKernels) {
+                .skip_whitespace  = scan_skip_whitespace_sse2,
+                .find_byte        = scan_find_byte_sse2,
+                .find_comment_end = scan_find_comment_end_sse2,
+                .count_newlines   = scan_count_newlines_sse2,
+            };
+            break;
+#endif
+        default:
+            level = SCAN_SCALAR;
+            scan_kernels = (ScanKernels) {
+                .skip_whitespace  = scan_skip_whitespace_scalar,
+                .find_byte        = scan_find_byte_scalar,
+                .find_comment_end = scan_find_comment_end_scalar,
+                .count_newlines   = scan_count_newlines_scalar,
+            };
+            break;
+    }
+    return level;
+}
+
+const char *display_scan_level(ScanLevel level)
+{
+    switch(level) {
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE2:   return "sse2";
+        case SCAN_AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+void scan_ensure_selected(void)
+{
+    if(scan_kernels.skip_whitespace == NULL) scan_select(SCAN_AVX2);
+}
+
+const char *scan_skip_whitespace(const char *begin, const char *end)
+{
+    if(scan_kernels.skip_whitespace == NULL) scan_select(SCAN_AVX2);
+    return scan_kernels.skip_whitespace(begin, end);
+}
+
+const char *scan_find_byte(const char *begin, const char *end, char ch)
+{
+    if(scan_kernels.find_byte == NULL) scan_select(SCAN_AVX2);
+    return scan_kernels.find_byte(begin, end, ch);
+}
+
+const char *scan_find_comment_end(const char *begin, const char *end)
+{
+    if(scan_kernels.find_comment_end == NULL) scan_select(SCAN_AVX2);
+    return scan_kernels.find_comment_end(begin, end);
+}
+
+size_t scan_count_newlines(const char *begin, const char *end, const char **line_start)
+{
+    if(scan_kernels.count_newlines == NULL) scan_select(SCAN_AVX2);
+    return scan_kernels.count_newlines(begin, end, line_start);
+}
+
+// SWAR
+//
+// Runs of identifier characters or digits are usually too short for the
+// vector kernels to pay off, so these classify 8 bytes at a time in a
+// plain 64 bit register. They do not depend on the selected level.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SCAN_SWAR 0
+#else
+#define SCAN_SWAR 1
+#endif
+
+#define SWAR_ONES  0x0101010101010101ull
+#define SWAR_HIGHS 0x8080808080808080ull
+
+// Sets the high bit of every byte of x with lo < byte < hi. Exact per
+// byte for 0 <= lo <= 127 and 0 <= hi <= 128, bytes >= 0x80 never match.
+static inline uint64_t scan_swar_between(uint64_t x, uint8_t lo, uint8_t hi)
+{
+    uint64_t low7 = x & (SWAR_ONES * 127);
+    return (SWAR_ONES * (127 + hi) - low7) & ~x & (low7 + SWAR_ONES * (127 - lo)) & SWAR_HIGHS;
+}
+
+static inline uint64_t scan_swar_digits(uint64_t x)
+{
+    return scan_swar_between(x, '0' - 1, '9' + 1);
+}
+
+static inline uint64_t scan_swar_identifier(uint64_t x)
+{
+    // Setting 0x20 folds A-Z onto a-z and moves nothing else into a-z
+    return scan_swar_digits(x)
+         | scan_swar_between(x | (SWAR_ONES * 0x20), 'a' - 1, 'z' + 1)
+         | scan_swar_between(x, '_' - 1, '_' + 1);
+}
+
+const char *scan_skip_identifier(const char *begin, const char *end)
+{
+#if SCAN_SWAR
+    while(end - begin >= 8) {
+        uint64_t x;
+        memcpy(&x, begin, sizeof(x));
+        uint64_t stop = ~scan_swar_identifier(x) & SWAR_HIGHS;
+        if(stop != 0) return begin + scan_ctz64(stop) / 8;
+        begin += 8;
+    }
+#endif
+    while(begin < end && char_is(*begin, CHAR_IDENT)) begin += 1;
+    return begin;
+}
+
+const char *scan_skip_digits(const char *begin, const char *end)
+{
+#if SCAN_SWAR
+    while(end - begin >= 8) {
+        uint64_t x;
+        memcpy(&x, begin, sizeof(x));
+        uint64_t stop = ~scan_swar_digits(x) & SWAR_HIGHS;
+        if(stop != 0) return begin + scan_ctz64(stop) / 8;
+        begin += 8;
+    }
+#endif
+    while(begin < end && char_is(*begin, CHAR_DIGIT)) begin += 1;
+    return begin;
+}
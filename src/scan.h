@@ -0,0 +1,38 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stddef.h>
+
+// Byte scanning kernels used by the lexer. Each has a scalar, SSE2 and
+// AVX2 implementation, the widest one the CPU supports is picked on the
+// first call. Every kernel returns `end` when nothing is found.
+
+typedef enum {
+    SCAN_SCALAR = 0,
+    SCAN_SSE2,
+    SCAN_AVX2,
+} ScanLevel;
+
+// Picks the widest kernels supported by the CPU, but not wider than
+// max_level, and returns the level that was picked
+ScanLevel scan_select(ScanLevel max_level);
+const char *display_scan_level(ScanLevel level);
+// Picks the widest kernels unless scan_select() already ran
+void scan_ensure_selected(void);
+
+// First byte in [begin, end) that is not one of " \t\n\v\f\r"
+const char *scan_skip_whitespace(const char *begin, const char *end);
+// First occurrence of ch in [begin, end)
+const char *scan_find_byte(const char *begin, const char *end, char ch);
+// First "*/" in [begin, end), pointing at the '*'
+const char *scan_find_comment_end(const char *begin, const char *end);
+// Number of '\n' in [begin, end). When there is at least one, *line_start
+// is set to the byte right after the last of them.
+size_t scan_count_newlines(const char *begin, const char *end, const char **line_start);
+// The two below run the same SWAR code at every level.
+// First byte in [begin, end) that is not a-z A-Z 0-9 _
+const char *scan_skip_identifier(const char *begin, const char *end);
+// First byte in [begin, end) that is not 0-9
+const char *scan_skip_digits(const char *begin, const char *end);
+
+#endif // SCAN_H_
@@ -0,0 +1,342 @@
+#include "server.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#    include <signal.h>
+#    include <sys/socket.h>
+#    include <sys/stat.h>
+#    include <sys/un.h>
+#    include <unistd.h>
+#endif
+
+#define SERVER_MAGIC "blnc-server 1\n"
+// Anything longer is not something a client meant to send
+#define SERVER_MAX_MESSAGE ((uint64_t)1 << 32)
+
+bool server_open_input(ServerRequest *request, const char *path, SourceFile *file)
+{
+    for(size_t i = 0; i < request->inputs.count; ++i) {
+        ServerFile *input = &request->inputs.items[i];
+        if(strcmp(input->path, path) != 0) continue;
+        // A heap copy, followed by the '\0' the lexer stops at
+        file->data = malloc(input->contents.count + 1);
+        assert(file->data != NULL && "Buy more RAM LOL!");
+        if(input->contents.count > 0) memcpy(file->data, input->contents.items, input->contents.count);
+        file->data[input->contents.count] = '\0';
+        file->size = input->contents.count;
+        file->mapped = false;
+        return true;
+    }
+    return false;
+}
+
+void server_write_output(ServerRequest *request, const char *path, const char *data, size_t size)
+{
+    ServerFile output = { .path = strdup(path) };
+    assert(output.path != NULL && "Buy more RAM LOL!");
+    if(size > 0) nob_sb_append_buf(&output.contents, data, size);
+    nob_da_append(&request->outputs, output);
+}
+
+#ifdef _WIN32
+bool server_serve(const char *socket_path, ServerHandler handler, void *data)
+{
+    (void)socket_path;
+    (void)handler;
+    (void)data;
+    nob_log(NOB_ERROR, "The compiler server needs fork(), it is not available on Windows");
+    return false;
+}
+
+int server_send_command(const char *socket_path, int argc, char **argv)
+{
+    (void)socket_path;
+    (void)argc;
+    (void)argv;
+    nob_log(NOB_ERROR, "The compiler server is not available on Windows");
+    return -1;
+}
+#else
+// WIRE
+//
+// Sizes and counts go as 64 bit integers in the byte order of the host,
+// both ends are on the same machine. Anything of variable size is a
+// size followed by that many bytes.
+
+static bool wire_write(int fd, const void *data, size_t size)
+{
+    const char *at = data;
+    while(size > 0) {
+        ssize_t n = write(fd, at, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        at += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool wire_read(int fd, void *data, size_t size)
+{
+    char *at = data;
+    while(size > 0) {
+        ssize_t n = read(fd, at, size);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        at += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool wire_write_u64(int fd, uint64_t value)
+{
+    return wire_write(fd, &value, sizeof(value));
+}
+
+static bool wire_read_u64(int fd, uint64_t *value)
+{
+    return wire_read(fd, value, sizeof(*value)) && *value <= SERVER_MAX_MESSAGE;
+}
+
+static bool wire_write_bytes(int fd, const char *data, size_t size)
+{
+    return wire_write_u64(fd, size) && wire_write(fd, data, size);
+}
+
+// Replaces the contents of sb, which stay followed by a '\0'
+static bool wire_read_bytes(int fd, Nob_String_Builder *sb)
+{
+    uint64_t size;
+    if(!wire_read_u64(fd, &size)) return false;
+    sb->count = 0;
+    nob_da_reserve(sb, (size_t)size + 1);
+    if(!wire_read(fd, sb->items, (size_t)size)) return false;
+    sb->items[size] = '\0';
+    sb->count = (size_t)size;
+    return true;
+}
+
+static bool wire_write_files(int fd, const ServerFiles *files)
+{
+    if(!wire_write_u64(fd, files->count)) return false;
+    for(size_t i = 0; i < files->count; ++i) {
+        const ServerFile *file = &files->items[i];
+        if(!wire_write_bytes(fd, file->path, strlen(file->path))) return false;
+        if(!wire_write_bytes(fd, file->contents.items, file->contents.count)) return false;
+    }
+    return true;
+}
+
+static bool wire_read_files(int fd, ServerFiles *files)
+{
+    uint64_t count;
+    if(!wire_read_u64(fd, &count)) return false;
+    for(uint64_t i = 0; i < count; ++i) {
+        Nob_String_Builder path = {0};
+        ServerFile file = {0};
+        bool ok = wire_read_bytes(fd, &path) && wire_read_bytes(fd, &file.contents);
+        file.path = path.items;
+        nob_da_append(files, file);
+        if(!ok) return false;
+    }
+    return true;
+}
+
+static void server_files_free(ServerFiles *files)
+{
+    for(size_t i = 0; i < files->count; ++i) {
+        free(files->items[i].path);
+        nob_da_free(files->items[i].contents);
+    }
+    nob_da_free(*files);
+}
+
+// Everything the file got since the command started
+static bool server_read_back(FILE *f, Nob_String_Builder *sb)
+{
+    if(fseek(f, 0, SEEK_SET) != 0) return false;
+    char buffer[64*1024];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), f)) > 0) nob_sb_append_buf(sb, buffer, n);
+    return !ferror(f);
+}
+
+// SERVER
+//
+// Runs in the child forked for the client, which exits right after
+
+static void server_serve_client(int fd, ServerHandler handler, void *data)
+{
+    char magic[sizeof(SERVER_MAGIC) - 1];
+    if(!wire_read(fd, magic, sizeof(magic)) || memcmp(magic, SERVER_MAGIC, sizeof(magic)) != 0) return;
+
+    uint64_t argc;
+    if(!wire_read_u64(fd, &argc)) return;
+    char **argv = calloc((size_t)argc + 1, sizeof(*argv));
+    assert(argv != NULL && "Buy more RAM LOL!");
+    for(uint64_t i = 0; i < argc; ++i) {
+        Nob_String_Builder arg = {0};
+        if(!wire_read_bytes(fd, &arg)) return;
+        argv[i] = arg.items;
+    }
+    Nob_String_Builder cwd = {0};
+    ServerRequest request = {0};
+    if(!wire_read_bytes(fd, &cwd) || !wire_read_files(fd, &request.inputs)) return;
+
+    // Whatever the command prints goes back to the client
+    FILE *out = tmpfile();
+    FILE *err = tmpfile();
+    if(out == NULL || err == NULL) return;
+    fflush(stdout);
+    fflush(stderr);
+    if(dup2(fileno(out), STDOUT_FILENO) < 0 || dup2(fileno(err), STDERR_FILENO) < 0) return;
+
+    int exit_code = -1;
+    // Paths relative to the client mean the same here
+    if(chdir(cwd.items) == 0) {
+        exit_code = handler(data, (int)argc, argv, &request);
+    } else {
+        fprintf(stderr, "error: could not enter %s: %s\n", cwd.items, strerror(errno));
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    Nob_String_Builder printed_out = {0};
+    Nob_String_Builder printed_err = {0};
+    if(!server_read_back(out, &printed_out) || !server_read_back(err, &printed_err)) return;
+    (void)(wire_write_u64(fd, (uint64_t)(int64_t)exit_code)
+        && wire_write_bytes(fd, printed_out.items, printed_out.count)
+        && wire_write_bytes(fd, printed_err.items, printed_err.count)
+        && wire_write_files(fd, &request.outputs));
+}
+
+bool server_serve(const char *socket_path, ServerHandler handler, void *data)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+        nob_log(NOB_ERROR, "Socket path %s is too long", socket_path);
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server < 0) {
+        nob_log(NOB_ERROR, "Could not create a socket: %s", strerror(errno));
+        return false;
+    }
+    // Left behind by a server that is gone
+    unlink(socket_path);
+    if(bind(server, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, SOMAXCONN) < 0) {
+        nob_log(NOB_ERROR, "Could not listen on %s: %s", socket_path, strerror(errno));
+        close(server);
+        return false;
+    }
+    // The children are never waited for, and a client that went away
+    // only fails the writes to it
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Serving on %s\n", socket_path);
+
+    while(true) {
+        int client = accept(server, NULL, NULL);
+        if(client < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+            nob_log(NOB_ERROR, "Could not accept a client: %s", strerror(errno));
+            break;
+        }
+        pid_t pid = fork();
+        if(pid == 0) {
+            close(server);
+            server_serve_client(client, handler, data);
+            _exit(0);
+        }
+        if(pid < 0) nob_log(NOB_ERROR, "Could not fork for a client: %s", strerror(errno));
+        close(client);
+    }
+    close(server);
+    unlink(socket_path);
+    return false;
+}
+
+// CLIENT
+
+static bool server_send_request(int fd, int argc, char **argv)
+{
+    char cwd[4096];
+    if(getcwd(cwd, sizeof(cwd)) == NULL) {
+        nob_log(NOB_ERROR, "Could not get the working directory: %s", strerror(errno));
+        return false;
+    }
+    // Every argument that names a file is sent along, the client does not
+    // know which of them the command reads
+    ServerFiles inputs = {0};
+    for(int i = 0; i < argc; ++i) {
+        struct stat st;
+        if(argv[i][0] == '-' || stat(argv[i], &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        ServerFile input = { .path = argv[i] };
+        if(!nob_read_entire_file(argv[i], &input.contents)) continue;
+        nob_da_append(&inputs, input);
+    }
+
+    bool ok = wire_write(fd, SERVER_MAGIC, strlen(SERVER_MAGIC)) && wire_write_u64(fd, (uint64_t)argc);
+    for(int i = 0; i < argc && ok; ++i) ok = wire_write_bytes(fd, argv[i], strlen(argv[i]));
+    ok = ok && wire_write_bytes(fd, cwd, strlen(cwd)) && wire_write_files(fd, &inputs);
+
+    for(size_t i = 0; i < inputs.count; ++i) nob_da_free(inputs.items[i].contents);
+    nob_da_free(inputs);
+    return ok;
+}
+
+int server_send_command(const char *socket_path, int argc, char **argv)
+{
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+        nob_log(NOB_ERROR, "Socket path %s is too long", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        nob_log(NOB_ERROR, "Could not connect to %s: %s", socket_path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    uint64_t exit_code = (uint64_t)-1;
+    Nob_String_Builder printed_out = {0};
+    Nob_String_Builder printed_err = {0};
+    ServerFiles outputs = {0};
+    bool ok = server_send_request(fd, argc, argv)
+           && wire_read(fd, &exit_code, sizeof(exit_code))
+           && wire_read_bytes(fd, &printed_out)
+           && wire_read_bytes(fd, &printed_err)
+           && wire_read_files(fd, &outputs);
+    close(fd);
+    if(!ok) {
+        nob_log(NOB_ERROR, "The server at %s did not finish the command", socket_path);
+        exit_code = (uint64_t)-1;
+    }
+
+    if(printed_out.count > 0) fwrite(printed_out.items, 1, printed_out.count, stdout);
+    if(printed_err.count > 0) fwrite(printed_err.items, 1, printed_err.count, stderr);
+    for(size_t i = 0; ok && i < outputs.count; ++i) {
+        ServerFile *output = &outputs.items[i];
+        if(!nob_write_entire_file(output->path, output->contents.items, output->contents.count)) exit_code = (uint64_t)-1;
+    }
+
+    nob_da_free(printed_out);
+    nob_da_free(printed_err);
+    server_files_free(&outputs);
+    return (int)(int64_t)exit_code;
+}
+#endif // _WIN32
@@ -0,0 +1,51 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "nob.h"
+#include "source_file.h"
+
+// Compiler server on a Unix domain socket. A client sends the arguments
+// of one blnc command, its working directory and the contents of the
+// files it names, and gets back what the command printed, the files it
+// wrote and its exit code. Every request is served by a child forked off
+// the server: requests run at the same time, all of them start from the
+// state the server warmed up and none sees what another one did. The
+// server is POSIX only.
+
+typedef struct {
+    char *path;
+    Nob_String_Builder contents;
+} ServerFile;
+
+typedef struct {
+    ServerFile *items;
+    size_t count;
+    size_t capacity;
+} ServerFiles;
+
+// The files of one request, the ones the client sent and the ones to send
+// back to it
+typedef struct {
+    ServerFiles inputs;
+    ServerFiles outputs;
+} ServerRequest;
+
+// Runs one command. argv holds its arguments without the program name,
+// whatever it prints goes to the client.
+typedef int (*ServerHandler)(void *data, int argc, char **argv, ServerRequest *request);
+
+// Serves until accepting a client fails
+bool server_serve(const char *socket_path, ServerHandler handler, void *data);
+// Runs a command on the server at socket_path, printing what it printed
+// and writing the files it wrote. Returns the exit code of the command,
+// or -1 when the server could not be reached.
+int server_send_command(const char *socket_path, int argc, char **argv);
+
+// Opens a file the client sent, like source_file_open() does from disk
+bool server_open_input(ServerRequest *request, const char *path, SourceFile *file);
+// Writes a file on the side of the client once the command is done
+void server_write_output(ServerRequest *request, const char *path, const char *data, size_t size);
+
+#endif // SERVER_H_
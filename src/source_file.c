@@ -0,0 +1,147 @@
+#include "source_file.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nob.h"
+
+#ifndef _WIN32
+#    include <sys/mman.h>
+#endif
+
+// A mapping only has the sentinel for free when the file ends inside a
+// page: the kernel zero fills the rest of that last page. A file that is
+// empty or a whole number of pages long has nothing readable after it.
+static bool source_file_tail_is_zeroed(size_t size, size_t page_size)
+{
+    return size > 0 && size % page_size != 0;
+}
+
+#ifdef _WIN32
+static bool source_file_map(const char *path, SourceFile *file)
+{
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(handle == INVALID_HANDLE_VALUE) return false;
+
+    bool result = false;
+    LARGE_INTEGER size;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if(!GetFileSizeEx(handle, &size) || (uint64_t)size.QuadPart > SIZE_MAX) goto defer;
+    if(!source_file_tail_is_zeroed((size_t)size.QuadPart, info.dwPageSize)) goto defer;
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping == NULL) goto defer;
+    // The view keeps the mapping alive after both handles are closed
+    char *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if(data == NULL) goto defer;
+
+    file->data = data;
+    file->size = (size_t)size.QuadPart;
+    file->mapped = true;
+    result = true;
+defer:
+    CloseHandle(handle);
+    return result;
+}
+
+static void source_file_unmap(SourceFile *file)
+{
+    UnmapViewOfFile(file->data);
+}
+
+static size_t source_file_page_size(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+}
+
+static void source_file_drop_pages(char *begin, size_t size)
+{
+    // Unlocking pages that are not locked takes them out of the working set
+    VirtualUnlock(begin, size);
+}
+#else
+static bool source_file_map(const char *path, SourceFile *file)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return false;
+
+    bool result = false;
+    struct stat st;
+    long page_size = sysconf(_SC_PAGESIZE);
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || page_size <= 0) goto defer;
+    if(!source_file_tail_is_zeroed((size_t)st.st_size, (size_t)page_size)) goto defer;
+
+    char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) goto defer;
+    // The lexer walks the file front to back exactly once
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    file->mapped = true;
+    result = true;
+defer:
+    close(fd);
+    return result;
+}
+
+static void source_file_unmap(SourceFile *file)
+{
+    munmap(file->data, file->size);
+}
+
+static size_t source_file_page_size(void)
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void source_file_drop_pages(char *begin, size_t size)
+{
+    // The mapping is private and never written, dropped pages are read
+    // back from the file
+    madvise(begin, size, MADV_DONTNEED);
+}
+#endif // _WIN32
+
+bool source_file_open(const char *path, SourceFile *file)
+{
+    memset(file, 0, sizeof(*file));
+    if(source_file_map(path, file)) return true;
+
+    // Fallback for files the sentinel can not be mapped for. Directories
+    // open fine on POSIX but can not be read
+    if(nob_get_file_type(path) != NOB_FILE_REGULAR) return false;
+    Nob_String_Builder sb = {0};
+    if(!nob_read_entire_file(path, &sb)) return false;
+    file->size = sb.count;
+    nob_sb_append_null(&sb);
+    file->data = sb.items;
+    file->mapped = false;
+    return true;
+}
+
+void source_file_close(SourceFile *file)
+{
+    if(file->data == NULL) return;
+    if(file->mapped) {
+        source_file_unmap(file);
+    } else {
+        free(file->data);
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+void source_file_release(SourceFile *file, const char *upto)
+{
+    // A heap copy would lose its contents
+    if(!file->mapped) return;
+    assert(file->data <= upto && upto <= file->data + file->size);
+    size_t size = (size_t)(upto - file->data) / source_file_page_size() * source_file_page_size();
+    if(size > 0) source_file_drop_pages(file->data, size);
+}
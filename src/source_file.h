@@ -0,0 +1,24 @@
+#ifndef SOURCE_FILE_H_
+#define SOURCE_FILE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A source file loaded for the lexer. The contents are mapped read-only
+// straight from the page cache when possible, otherwise copied into a
+// heap buffer. Either way data[size] is a readable '\0', the lexer uses
+// that sentinel to stop instead of comparing against eof on every byte.
+typedef struct {
+    char *data;
+    size_t size;
+    bool mapped;
+} SourceFile;
+
+bool source_file_open(const char *path, SourceFile *file);
+void source_file_close(SourceFile *file);
+// Lets the OS drop the pages of a mapped file before `upto` from memory,
+// for callers that are done with them. They stay readable, the OS reads
+// them back in when they are touched again.
+void source_file_release(SourceFile *file, const char *upto);
+
+#endif // SOURCE_FILE_H_
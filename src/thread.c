@@ -0,0 +1,78 @@
+#include "thread.h"
+#include <assert.h>
+
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <sched.h>
+#    include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID data)
+{
+    Thread *thread = data;
+    thread->proc(thread->data);
+    return 0;
+}
+
+void thread_start(Thread *thread, ThreadProc proc, void *data)
+{
+    thread->proc = proc;
+    thread->data = data;
+    thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+    assert(thread->handle != NULL && "Could not start a thread");
+}
+
+void thread_join(Thread *thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    thread->handle = NULL;
+}
+
+void thread_yield(void)
+{
+    SwitchToThread();
+}
+
+size_t thread_count_processors(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (size_t)info.dwNumberOfProcessors : 1;
+}
+#else
+static void *thread_entry(void *data)
+{
+    Thread *thread = data;
+    thread->proc(thread->data);
+    return NULL;
+}
+
+void thread_start(Thread *thread, ThreadProc proc, void *data)
+{
+    thread->proc = proc;
+    thread->data = data;
+    int result = pthread_create(&thread->handle, NULL, thread_entry, thread);
+    assert(result == 0 && "Could not start a thread");
+    (void)result;
+}
+
+void thread_join(Thread *thread)
+{
+    pthread_join(thread->handle, NULL);
+}
+
+void thread_yield(void)
+{
+    sched_yield();
+}
+
+size_t thread_count_processors(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
+#endif // _WIN32
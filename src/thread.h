@@ -0,0 +1,32 @@
+#ifndef THREAD_H_
+#define THREAD_H_
+
+#include <stddef.h>
+
+#ifndef _WIN32
+#    include <pthread.h>
+#endif
+
+// Just enough threading for the compiler, over Win32 threads or pthreads
+
+typedef void (*ThreadProc)(void *data);
+
+typedef struct {
+#ifdef _WIN32
+    void *handle;
+#else
+    pthread_t handle;
+#endif
+    ThreadProc proc;
+    void *data;
+} Thread;
+
+// The Thread is handed to the new thread, it must not move until joined
+void thread_start(Thread *thread, ThreadProc proc, void *data);
+void thread_join(Thread *thread);
+// Gives the processor to another thread, for threads waiting on another
+void thread_yield(void);
+// Number of logical processors, at least 1
+size_t thread_count_processors(void);
+
+#endif // THREAD_H_